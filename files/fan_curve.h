@@ -0,0 +1,108 @@
+/*
+ * File:   fan_curve.h
+ * Author: George Nikolaidis
+ *
+ * Fan curve and PWM frequency, set at build time, ex. -DPWM_FREQUENCY=10000
+ * -DFAN_CURVE_T1=40 -DFAN_CURVE_D1=50
+ *
+ * The curve is four breakpoints, temperature in Celsius and duty in %.
+ * Below T0 the fan is off, between breakpoints the duty is interpolated
+ * linearly, above T3 it stays at D3.
+ * The preprocessor turns the curve into a table with one entry per degree,
+ * each entry holding the CCPR1L value and the CCP1CON value with DC1B<1:0>,
+ * so the full 10 bit duty cycle is used (320 steps at 25khz, 800 at 10khz)
+ * and the lookup at run time is one index for both registers.
+ * FAN_HYSTERESIS is how far below a band, in 1/16 C, the temperature has to
+ * drop before the duty steps down.
+ * With the tach the same curve scaled to FAN_RPM_MAX is the fan speed to
+ * hold, FAN_RPM(), and the duty of the curve is where the loop starts from.
+ */
+
+#ifndef FAN_CURVE_H
+#define FAN_CURVE_H
+
+#ifndef PWM_FREQUENCY
+#define PWM_FREQUENCY           25000
+#endif
+
+#if PWM_FREQUENCY == 25000
+#define PWM_PR2                 0x4F                                            /* (79 + 1) * 4 * 125ns = 40us */
+#elif PWM_FREQUENCY == 10000
+#define PWM_PR2                 0xC7                                            /* (199 + 1) * 4 * 125ns = 100us */
+#else
+#error "PWM_FREQUENCY must be 25000 or 10000"
+#endif
+
+#define PWM_DUTY_MAX            (4L * (PWM_PR2 + 1))                            /* CCPR1L:DC1B at 100%, 320 or 800 */
+
+                                                                                /* defaults follow the old 5 degree steps,
+                                                                                 * 15% at 30C rising 3% per degree, each one
+                                                                                 * can be set on its own */
+#ifndef FAN_CURVE_T0
+#define FAN_CURVE_T0            30
+#endif
+#ifndef FAN_CURVE_D0
+#define FAN_CURVE_D0            15
+#endif
+#ifndef FAN_CURVE_T1
+#define FAN_CURVE_T1            45
+#endif
+#ifndef FAN_CURVE_D1
+#define FAN_CURVE_D1            60
+#endif
+#ifndef FAN_CURVE_T2
+#define FAN_CURVE_T2            55
+#endif
+#ifndef FAN_CURVE_D2
+#define FAN_CURVE_D2            90
+#endif
+#ifndef FAN_CURVE_T3
+#define FAN_CURVE_T3            60
+#endif
+#ifndef FAN_CURVE_D3
+#define FAN_CURVE_D3            100
+#endif
+
+#ifndef FAN_HYSTERESIS
+#define FAN_HYSTERESIS          8                                               /* 0.5C */
+#endif
+
+#ifndef FAN_RPM_MAX
+#define FAN_RPM_MAX             3000                                            /* fan speed at 100%, for the tach */
+#endif
+
+#define FAN_LUT_SIZE            32
+#define FAN_LUT_BASE            (FAN_CURVE_T0 - 1)                              /* entry 0 is "off", everything below T0 */
+
+#if FAN_CURVE_T0 >= FAN_CURVE_T1 || FAN_CURVE_T1 >= FAN_CURVE_T2 || FAN_CURVE_T2 >= FAN_CURVE_T3
+#error "fan curve temperatures must rise, no two breakpoints at one temperature"
+#endif
+#if FAN_CURVE_T3 - FAN_LUT_BASE > FAN_LUT_SIZE - 1
+#error "fan curve spans more than FAN_LUT_SIZE - 2 degrees"
+#endif
+#if FAN_CURVE_D3 > 100
+#error "fan curve duty above 100%"
+#endif
+
+#define FAN_D10(d)              ((d) * PWM_DUTY_MAX / 100)                      /* % to 10 bit duty */
+#define FAN_LERP(t, ta, da, tb, db) \
+        (FAN_D10(da) + ((FAN_D10(db) - FAN_D10(da)) * ((t) - (ta)) + ((tb) - (ta)) / 2) / ((tb) - (ta)))
+#define FAN_DUTY10(t)           ((t) < FAN_CURVE_T0 ? 0 :                                                             \
+                                 (t) < FAN_CURVE_T1 ? FAN_LERP(t, FAN_CURVE_T0, FAN_CURVE_D0, FAN_CURVE_T1, FAN_CURVE_D1) : \
+                                 (t) < FAN_CURVE_T2 ? FAN_LERP(t, FAN_CURVE_T1, FAN_CURVE_D1, FAN_CURVE_T2, FAN_CURVE_D2) : \
+                                 (t) < FAN_CURVE_T3 ? FAN_LERP(t, FAN_CURVE_T2, FAN_CURVE_D2, FAN_CURVE_T3, FAN_CURVE_D3) : \
+                                 FAN_D10(FAN_CURVE_D3))
+
+#define FAN_RPM(t)              ((unsigned int)(FAN_DUTY10(t) * (long)FAN_RPM_MAX / PWM_DUTY_MAX))  /* curve in rpm */
+#define FAN_CCPR1L(t)           ((unsigned char)(FAN_DUTY10(t) >> 2))
+#define FAN_CCP1CON(t)          ((unsigned char)(0x0C | ((FAN_DUTY10(t) & 0x3) << 4)))  /* PWM mode, DC1B<1:0> */
+
+                                                                                /* one table entry per degree from FAN_LUT_BASE */
+#define FAN_LUT_1(f, i)         f(FAN_LUT_BASE + (i))
+#define FAN_LUT_2(f, i)         FAN_LUT_1(f, i), FAN_LUT_1(f, (i) + 1)
+#define FAN_LUT_4(f, i)         FAN_LUT_2(f, i), FAN_LUT_2(f, (i) + 2)
+#define FAN_LUT_8(f, i)         FAN_LUT_4(f, i), FAN_LUT_4(f, (i) + 4)
+#define FAN_LUT_16(f, i)        FAN_LUT_8(f, i), FAN_LUT_8(f, (i) + 8)
+#define FAN_LUT(f)              FAN_LUT_16(f, 0), FAN_LUT_16(f, 16)
+
+#endif
@@ -0,0 +1,88 @@
+/*
+ * File:   hal.h
+ * Author: George Nikolaidis
+ *
+ * Hardware abstraction for nmain.c
+ * Built with XC8 every macro below is a plain register access, exactly what
+ * nmain.c wrote before. Built with any other compiler the same macros call
+ * into the PIC12F615 simulator in sim/, so the firmware runs on Linux and
+ * every register access and delay is counted in 500ns instruction cycles.
+ * HAL_CYCLES() charges the few stretches of plain C that matter for timing,
+ * an estimate counted by hand from the instructions XC8 makes of them. The
+ * rest of the C costs the simulated pic nothing, its cycles are a model.
+ * HAL_ROM tables are const in flash on the pic, the fan curve among them.
+ * The host build leaves them writable, the fleet simulator loads a curve
+ * per run instead of a build per curve.
+ * HAL_RAM marks the globals, which XC8 startup code clears or loads at every
+ * reset, watchdog resets too. The host build keeps them in a section of
+ * their own, the simulator puts them back as loaded on every reset.
+ * HAL_PROFILE_ENTER() and HAL_PROFILE_EXIT() mark a function for the modelled
+ * cycle profile, see sim/profile_sim.h. They are nothing with XC8 or without
+ * -DPROFILE=1, and cost the simulated pic no cycles either way.
+ */
+
+#ifndef HAL_H
+#define HAL_H
+
+#ifdef __XC8
+
+#include <xc.h>
+
+#define HAL_REG_WRITE(reg, value)           (reg                = (value))
+#define HAL_REG_READ(reg)                   (reg)
+#define HAL_BIT_WRITE(reg, bit, value)      (reg##bits.bit      = (value))
+#define HAL_BIT_READ(reg, bit)              (reg##bits.bit)
+#define HAL_NOP()                           NOP()
+#define HAL_IDLE()                          NOP()                               /* waiting for an interrupt */
+#define HAL_SLEEP()                         SLEEP()
+#define HAL_CLRWDT()                        CLRWDT()
+#define HAL_ISR(name)                       void __interrupt() name(void)
+#define HAL_CYCLES(n)                       ((void)0)                           /* the instructions are there already */
+#define HAL_ROM                             const                               /* in flash, RETLW tables */
+#define HAL_RAM                                                                 /* the startup code sets them */
+#define HAL_PROFILE_ENTER(name)             ((void)0)
+#define HAL_PROFILE_EXIT(name)              ((void)0)
+
+#else
+
+#include "sim/pic12f615_sim.h"
+
+#define HAL_REG_WRITE(reg, value)           sim_reg_write(SFR_##reg, (unsigned char)(value))
+#define HAL_REG_READ(reg)                   sim_reg_read(SFR_##reg)
+#define HAL_BIT_WRITE(reg, bit, value)      sim_bit_write(SFR_##reg, SIM_BIT_##bit, (unsigned char)(value))
+#define HAL_BIT_READ(reg, bit)              sim_bit_read(SFR_##reg, SIM_BIT_##bit)
+#define HAL_NOP()                           sim_nop()
+#define HAL_IDLE()                          sim_idle()
+#define HAL_SLEEP()                         sim_sleep()
+#define HAL_CLRWDT()                        sim_clrwdt()
+#define HAL_ISR(name)                       void sim_isr(void)                  /* called by the simulator on an enabled, pending interrupt */
+#define HAL_CYCLES(n)                       sim_cycles(n)                       /* hand counted C between register accesses */
+#ifndef HAL_ROM
+#define HAL_ROM                                                                 /* the fleet simulator swaps the curve */
+#endif
+#define HAL_RAM                             __attribute__((section("fwram")))   /* sim_reset() and the watchdog load them again */
+
+#ifndef PROFILE
+#define PROFILE                             0
+#endif
+#if PROFILE
+#include "sim/profile_sim.h"
+                                                                                /* every hook finds its function once, by name */
+#define HAL_PROFILE_ENTER(name)             do { static int profileId_ = -1; profile_sim_enter(&profileId_, name); } while(0)
+#define HAL_PROFILE_EXIT(name)              do { static int profileId_ = -1; profile_sim_exit(&profileId_, name); } while(0)
+#else
+#define HAL_PROFILE_ENTER(name)             ((void)0)
+#define HAL_PROFILE_EXIT(name)              ((void)0)
+#endif
+
+                                                                                /* XC8 builds the delays from _XTAL_FREQ, so do we */
+#define __delay_us(x)                       sim_delay((unsigned long)(x) * (_XTAL_FREQ / 4000000UL))
+#define __delay_ms(x)                       sim_delay_ms((unsigned long)(x) * (_XTAL_FREQ / 4000UL))
+
+                                                                                /* main() never returns on the PIC, the simulator calls it
+                                                                                 * under its own name and stops it when the cycle budget ends */
+#define main                                firmware_main
+
+#endif
+
+#endif
@@ -0,0 +1,1011 @@
+/*
+ * File:   size_report.c
+ * Author: George Nikolaidis
+ *
+ * Flash and RAM of an XC8 build of nmain.c against what the PIC12F615 has,
+ * 1024 words of flash and 64 bytes of RAM, and against the "flash" and
+ * "ram" lines of a budget file, files/budget.txt.
+ *
+ * From the .map file XC8 writes with -Wl,-Map: the psect table gives the
+ * length and space of every psect, space 0 is flash in words, space 1 RAM
+ * in bytes. Each function is a text psect of its own, a symbol ends where
+ * the next one in its psect starts or at the end of the psect. The RAM of
+ * a function is its parameters ?_name and autos ??_name in the compiled
+ * stack, which XC8 overlays for functions that never run at the same time,
+ * so those add up to more than the cstack psects. Globals are the _name
+ * symbols of the other RAM psects.
+ * From the .hex file only the flash in use is known, the config word at
+ * 0x2007 is not counted. A .hex is not taken together with a .i, nothing
+ * says the two are the same build, the .hex in files/ is the pre-series
+ * release and older than the source.
+ * From the preprocessed source, a .i file, only the RAM, laid out the way
+ * XC8 does it, see SOURCE LAYOUT below.
+ *
+ * A budget line is "flash <function|total> <words>" or "ram
+ * <function|global|total> <bytes>". A line none of the files given can
+ * answer fails, as does a name in the budget that is not in the build.
+ *
+ * usage: fanctl-size [-b budget] file.map|file.hex|file.i...
+ *   -b  check against the budget file, exit with 1 if over
+ *
+ *     gcc -std=c99 -O2 -Wall -o fanctl-size files/host/size_report.c
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PIC_FLASH_WORDS     1024
+#define PIC_RAM_BYTES       64
+#define PIC_ISR_SAVE        4                                                   /* W, STATUS, PCLATH and FSR, saved on interrupt entry */
+#define MAX_PSECTS          128
+#define MAX_SYMBOLS         1024
+#define MAX_TOKENS          262144                                              /* the curve tables take most */
+#define MAX_FUNCTIONS       64
+#define MAX_CALLS           16
+#define MAX_TAGS            16
+#define SPACE_CODE          0
+#define SPACE_DATA          1
+
+#define FROM_NONE           0                                                   /* where the flash and the RAM figures come from */
+#define FROM_HEX            1
+#define FROM_MAP            2
+#define FROM_SOURCE         3
+
+struct psect {
+    char     name[32];
+    unsigned link;
+    unsigned length;
+    int      space;
+};
+
+struct symbol {
+    char     name[48];
+    int      psect;
+    unsigned addr;
+    unsigned size;
+};
+
+struct function {
+    char     name[48];
+    unsigned frame;                                                             /* parameters or return value, and autos */
+    int      isr;
+    int      ncalls;
+    char     calls[MAX_CALLS][48];
+    int      callee[MAX_CALLS];
+    unsigned depth;                                                             /* its frame and the deepest chain it calls */
+    int      deepest;                                                           /* the callee on that chain, -1 none */
+    int      state;                                                             /* 0 not yet, 1 on the way, 2 done */
+};
+
+struct tag {
+    char     name[48];
+    unsigned size;
+};
+
+static struct psect psects[MAX_PSECTS];
+static int npsects;
+static struct symbol symbols[MAX_SYMBOLS];
+static int nsymbols;
+static unsigned flashTotal, ramTotal;
+static int flashFrom, ramFrom;
+
+static char *tokens[MAX_TOKENS];
+static int ntokens;
+static struct function functions[MAX_FUNCTIONS];
+static int nfunctions;
+static struct symbol globals[MAX_SYMBOLS];                                      /* psect unused */
+static int nglobals;
+static struct tag tags[MAX_TAGS];
+static int ntags;
+static int mainStack, isrStack;                                                 /* the roots, -1 none */
+
+static int isHex(const char *s){
+
+    if(!*s) return 0;
+    for(;*s;s++){
+        if(!strchr("0123456789abcdefABCDEF", *s)) return 0;
+    }
+    return 1;
+
+}
+
+static int findPsect(const char *name){
+
+    for(int i=0;i<npsects;i++){
+        if(!strcmp(psects[i].name, name)) return i;
+    }
+    return -1;
+
+}
+
+/* MAP FILE
+ * A psect line is "name link load length selector space [scale]", a symbol
+ * line after "Symbol Table" is "name psect value". Anything else, the object
+ * file names, the class and segment tables, is skipped. */
+static int readMap(FILE *f){
+
+    char line[256], tok[8][64];
+    int n, inSymbols = 0;
+
+    while(fgets(line, sizeof(line), f)){
+        if(strstr(line, "Symbol Table")){
+            inSymbols = 1;
+            continue;
+        }
+        n = sscanf(line, "%63s %63s %63s %63s %63s %63s %63s %63s",
+                   tok[0], tok[1], tok[2], tok[3], tok[4], tok[5], tok[6], tok[7]);
+        if(inSymbols && n == 3 && isHex(tok[2])){
+            int p = findPsect(tok[1]);
+
+            if(p < 0 || nsymbols == MAX_SYMBOLS) continue;
+            snprintf(symbols[nsymbols].name, sizeof(symbols[nsymbols].name), "%.*s", (int)sizeof(symbols[nsymbols].name) - 1, tok[0]);
+            symbols[nsymbols].psect = p;
+            symbols[nsymbols].addr  = (unsigned)strtoul(tok[2], NULL, 16);
+            nsymbols++;
+        } else if(!inSymbols && (n == 6 || n == 7) && isHex(tok[1]) && isHex(tok[2]) && isHex(tok[3])
+                  && isHex(tok[4]) && strspn(tok[5], "0123456789") == strlen(tok[5])){
+            int p = findPsect(tok[0]);
+
+            if(p < 0){
+                if(npsects == MAX_PSECTS) continue;
+                p = npsects++;
+                snprintf(psects[p].name, sizeof(psects[p].name), "%.*s", (int)sizeof(psects[p].name) - 1, tok[0]);
+                psects[p].link  = (unsigned)strtoul(tok[1], NULL, 16);
+                psects[p].space = atoi(tok[5]);
+            }
+            psects[p].length += (unsigned)strtoul(tok[3], NULL, 16);
+        }
+    }
+    if(!npsects) return 1;
+    flashTotal = 0;
+    for(int i=0;i<npsects;i++){
+        if(psects[i].space == SPACE_CODE) flashTotal += psects[i].length;
+        if(psects[i].space == SPACE_DATA) ramTotal   += psects[i].length;
+    }
+    flashFrom = FROM_MAP;
+    ramFrom   = FROM_MAP;
+    for(int i=0;i<nsymbols;i++){
+        struct symbol *s = &symbols[i];
+        unsigned end = psects[s->psect].link + psects[s->psect].length;
+
+        for(int j=0;j<nsymbols;j++){
+            if(symbols[j].psect == s->psect && symbols[j].addr > s->addr && symbols[j].addr < end){
+                end = symbols[j].addr;                                          /* the next one up */
+            }
+        }
+        s->size = end > s->addr ? end - s->addr : 0;
+    }
+    return 0;
+
+}
+
+/* HEX FILE
+ * Intel HEX, byte addresses, 2 bytes per 14 bit word. */
+static int readHex(FILE *f){
+
+    static unsigned char used[PIC_FLASH_WORDS];
+    char line[600];
+    unsigned base = 0, len, addr, type, byte, sum;
+
+    while(fgets(line, sizeof(line), f)){
+        if(line[0] != ':') continue;
+        if(sscanf(line + 1, "%2x%4x%2x", &len, &addr, &type) != 3 || strlen(line) < 11 + 2 * len) return 1;
+        sum = len + (addr >> 8) + (addr & 0xFF) + type;
+        for(unsigned i=0;i<=len;i++){
+            sscanf(line + 9 + 2 * i, "%2x", &byte);
+            sum += byte;
+            if(i == len) break;
+            if(type == 0){
+                unsigned word = (base + addr + i) >> 1;
+
+                if(word < PIC_FLASH_WORDS) used[word] = 1;                      /* the config word is past the end */
+            } else if(type == 4 && i == 1){
+                sscanf(line + 9, "%4x", &base);
+                base <<= 16;
+            }
+        }
+        if(sum & 0xFF) return 1;                                                /* checksum */
+        if(type == 1) break;
+    }
+    if(flashFrom == FROM_MAP) return 0;                                         /* the map has it per function */
+    flashTotal = 0;
+    for(int i=0;i<PIC_FLASH_WORDS;i++){
+        flashTotal += used[i];
+    }
+    flashFrom = FROM_HEX;
+    return 0;
+
+}
+
+/* SOURCE LAYOUT
+ * Without XC8 the RAM is laid out from nmain.c run through the host
+ * preprocessor, with HAL_ROM as the const it is on the pic:
+ *     gcc -E -DHAL_ROM=const files/nmain.c > nmain.i
+ * Only the lines of the first file are read, not the headers, with the
+ * sizes XC8 gives the types: char 1, short and int 2, long 4, a pointer 2,
+ * bit fields packed into bytes. Const objects are in flash. A function has
+ * its parameters or its return value, whichever is more, and its autos in
+ * the compiled stack. The stack is the deepest call chain from main() plus
+ * the deepest from the interrupt, which XC8 keeps apart, plus PIC_ISR_SAVE.
+ * What XC8 adds that is not in the source, the temporaries of an expression
+ * and the library routines a long multiply or divide calls, is not counted,
+ * the budget leaves room for it. Nothing about the flash. */
+static const char *typeWords[] = {
+    "void", "char", "short", "int", "long", "signed", "unsigned", "float", "double", "_Bool", "bit", "__bit",
+    "const", "volatile", "static", "extern", "register", "auto", "inline", "__inline", "__extension__",
+    "typedef", "struct", "union", "__interrupt", NULL
+};
+
+static const char *keywords[] = {
+    "if", "while", "for", "switch", "return", "sizeof", "do", "else", "case", NULL
+};
+
+static int isWord(const char *t, const char **list){
+
+    for(int i=0;list[i];i++){
+        if(!strcmp(t, list[i])) return 1;
+    }
+    return 0;
+
+}
+
+static int isIdent(const char *t){
+
+    return isalpha((unsigned char)t[0]) || t[0] == '_';
+
+}
+
+static int tok(int i, const char *s){
+
+    return i < ntokens && !strcmp(tokens[i], s);
+
+}
+
+static void tokenize(const char *s){
+
+    static const char *punct[] = {"<<=", ">>=", "...", "->", "++", "--", "<<", ">>", "<=", ">=", "==", "!=", "&&", "||",
+                                  "+=", "-=", "*=", "/=", "%=", "&=", "|=", "^=", NULL};
+    const char *start;
+    size_t n;
+
+    while(*s && ntokens < MAX_TOKENS){
+        start = s;
+        if(isspace((unsigned char)*s)){
+            s++;
+            continue;
+        }
+        if(isdigit((unsigned char)*s)){
+            while(isalnum((unsigned char)*s) || *s == '_' || *s == '.') s++;       /* 0x4F, 10UL */
+        } else if(isIdent(s)){
+            while(isalnum((unsigned char)*s) || *s == '_') s++;
+        } else if(*s == '"' || *s == '\''){
+            char quote = *s++;
+
+            while(*s && *s != quote){
+                if(*s == '\\' && s[1]) s++;
+                s++;
+            }
+            if(*s) s++;
+        } else {
+            n = 1;
+            for(int i=0;punct[i];i++){
+                if(!strncmp(s, punct[i], strlen(punct[i]))){
+                    n = strlen(punct[i]);
+                    break;
+                }
+            }
+            s += n;
+        }
+        n = (size_t)(s - start);
+        if(n > 47) n = 47;                                                      /* a name fits, a long string does not matter */
+        tokens[ntokens] = malloc(n + 1);
+        if(!tokens[ntokens]) return;
+        memcpy(tokens[ntokens], start, n);
+        tokens[ntokens][n] = 0;
+        ntokens++;
+    }
+
+}
+
+static int closing(int i){
+
+    char open = tokens[i][0];
+    char close = open == '(' ? ')' : open == '[' ? ']' : '}';
+    int depth = 0;
+
+    for(;i<ntokens;i++){
+        if(tokens[i][1]) continue;
+        if(tokens[i][0] == open) depth++;
+        else if(tokens[i][0] == close && --depth == 0) return i;
+    }
+    return ntokens;
+
+}
+
+/* Array sizes and bit field widths, the preprocessor left them as integer
+ * constant expressions. */
+static long evalCond(int *i, int end);
+
+static long evalUnary(int *i, int end){
+
+    long value;
+    char *stop;
+
+    if(*i >= end) return 0;
+    if(tok(*i, "-")){ (*i)++; return -evalUnary(i, end); }
+    if(tok(*i, "+")){ (*i)++; return evalUnary(i, end); }
+    if(tok(*i, "~")){ (*i)++; return ~evalUnary(i, end); }
+    if(tok(*i, "!")){ (*i)++; return !evalUnary(i, end); }
+    if(tok(*i, "(")){
+        if(isWord(tokens[*i + 1], typeWords)){
+            *i = closing(*i) + 1;                                               /* a cast */
+            return evalUnary(i, end);
+        }
+        (*i)++;
+        value = evalCond(i, end);
+        (*i)++;
+        return value;
+    }
+    if(tokens[*i][0] == '\''){
+        value = (unsigned char)tokens[*i][1];
+        (*i)++;
+        return value;
+    }
+    value = strtol(tokens[*i], &stop, 0);                                       /* the U and L suffixes stop it */
+    (*i)++;
+    return value;
+
+}
+
+static long evalBinary(int *i, int end, int level){
+
+    static const struct { const char *op; int level; } ops[] = {
+        {"||", 1}, {"&&", 2}, {"|", 3}, {"^", 4}, {"&", 5}, {"==", 6}, {"!=", 6},
+        {"<", 7}, {">", 7}, {"<=", 7}, {">=", 7}, {"<<", 8}, {">>", 8},
+        {"+", 9}, {"-", 9}, {"*", 10}, {"/", 10}, {"%", 10}, {NULL, 0}
+    };
+    long lhs = evalUnary(i, end);
+    long rhs;
+    int k;
+
+    for(;;){
+        for(k=0;ops[k].op && !(*i < end && tok(*i, ops[k].op));k++);
+        if(!ops[k].op || ops[k].level < level) return lhs;
+        (*i)++;
+        rhs = evalBinary(i, end, ops[k].level + 1);
+        switch(k){
+            case 0:  lhs = lhs || rhs; break;
+            case 1:  lhs = lhs && rhs; break;
+            case 2:  lhs |= rhs; break;
+            case 3:  lhs ^= rhs; break;
+            case 4:  lhs &= rhs; break;
+            case 5:  lhs = lhs == rhs; break;
+            case 6:  lhs = lhs != rhs; break;
+            case 7:  lhs = lhs < rhs; break;
+            case 8:  lhs = lhs > rhs; break;
+            case 9:  lhs = lhs <= rhs; break;
+            case 10: lhs = lhs >= rhs; break;
+            case 11: lhs <<= rhs; break;
+            case 12: lhs >>= rhs; break;
+            case 13: lhs += rhs; break;
+            case 14: lhs -= rhs; break;
+            case 15: lhs *= rhs; break;
+            case 16: lhs = rhs ? lhs / rhs : 0; break;
+            default: lhs = rhs ? lhs % rhs : 0; break;
+        }
+    }
+
+}
+
+static long evalCond(int *i, int end){
+
+    long cond = evalBinary(i, end, 1);
+    long a, b;
+
+    if(*i < end && tok(*i, "?")){
+        (*i)++;
+        a = evalCond(i, end);
+        (*i)++;                                                                 /* : */
+        b = evalCond(i, end);
+        return cond ? a : b;
+    }
+    return cond;
+
+}
+
+struct spec {
+    unsigned size;
+    int      isConst, isStatic, isExtern, isTypedef, isVoid, isInterrupt;
+};
+
+struct declarator {
+    char     name[48];
+    int      pointer;
+    int      function;                                                          /* the ( of its parameters, -1 none */
+    long     count;                                                             /* elements, 1 if not an array */
+    long     width;                                                             /* bit field, -1 none */
+};
+
+static int parseSpec(int i, int end, struct spec *sp);
+static int parseDeclarator(int i, int end, struct declarator *d);
+
+static unsigned sizeOf(const struct spec *sp, const struct declarator *d){
+
+    return (unsigned)((d->pointer ? 2 : sp->size) * d->count);
+
+}
+
+static int parseStruct(int i, int end, unsigned *size){
+
+    int isUnion = tok(i, "union");
+    char name[48] = "";
+    unsigned bits = 0;
+    int close;
+
+    i++;
+    if(i < end && isIdent(tokens[i]) && !tok(i, "__attribute__")){
+        strcpy(name, tokens[i]);
+        i++;
+    }
+    *size = 0;
+    if(!tok(i, "{")){
+        for(int t=0;t<ntags;t++){
+            if(!strcmp(tags[t].name, name)) *size = tags[t].size;
+        }
+        return i;
+    }
+    close = closing(i);
+    for(i++;i<close;){
+        struct spec member;
+        struct declarator d;
+        int j = parseSpec(i, close, &member);
+
+        if(j < 0){
+            i++;
+            continue;
+        }
+        i = j;
+        while(i < close && !tok(i, ";")){
+            i = parseDeclarator(i, close, &d);
+            if(d.width >= 0){
+                if(!d.width){
+                    bits = 0;                                                   /* :0 closes the byte */
+                } else {
+                    if(!bits || bits + d.width > 8){
+                        *size += isUnion ? 0 : 1;                               /* a field never crosses a byte */
+                        bits = 0;
+                    }
+                    bits = (bits + (unsigned)d.width) & 0x7;
+                    if(isUnion && *size < 1) *size = 1;
+                }
+            } else {
+                bits = 0;
+                if(isUnion){
+                    if(sizeOf(&member, &d) > *size) *size = sizeOf(&member, &d);
+                } else {
+                    *size += sizeOf(&member, &d);
+                }
+            }
+            if(!tok(i, ",")) break;
+            i++;
+        }
+        i++;
+    }
+    if(name[0] && ntags < MAX_TAGS){
+        strcpy(tags[ntags].name, name);
+        tags[ntags].size = *size;
+        ntags++;
+    }
+    return close + 1;
+
+}
+
+static int parseSpec(int i, int end, struct spec *sp){
+
+    int chars = 0, shorts = 0, longs = 0, floats = 0, any = 0, aggregate = 0;
+    const char *t;
+
+    memset(sp, 0, sizeof(*sp));
+    while(i < end){
+        t = tokens[i];
+        if(!strcmp(t, "__attribute__")){
+            i = closing(i + 1) + 1;
+            continue;
+        }
+        if(!isWord(t, typeWords)) break;
+        any = 1;
+        if(!strcmp(t, "struct") || !strcmp(t, "union")){
+            i = parseStruct(i, end, &sp->size);
+            aggregate = 1;
+            continue;
+        }
+        if(!strcmp(t, "const"))         sp->isConst = 1;
+        else if(!strcmp(t, "static"))   sp->isStatic = 1;
+        else if(!strcmp(t, "extern"))   sp->isExtern = 1;
+        else if(!strcmp(t, "typedef"))  sp->isTypedef = 1;
+        else if(!strcmp(t, "void"))     sp->isVoid = 1;
+        else if(!strcmp(t, "char") || !strcmp(t, "_Bool") || !strcmp(t, "bit") || !strcmp(t, "__bit")) chars++;
+        else if(!strcmp(t, "short"))    shorts++;
+        else if(!strcmp(t, "long"))     longs++;
+        else if(!strcmp(t, "float") || !strcmp(t, "double")) floats++;
+        else if(!strcmp(t, "__interrupt")){
+            sp->isInterrupt = 1;
+            if(tok(i + 1, "(")) i = closing(i + 1);                             /* __interrupt() */
+        }
+        i++;
+    }
+    if(!any) return -1;
+    if(!aggregate){
+        sp->size = sp->isVoid ? 0 : chars ? 1 : floats ? 4 : longs > 1 ? 8 : longs ? 4 : 2;
+    }
+    return i;
+
+}
+
+static int parseDeclarator(int i, int end, struct declarator *d){
+
+    int close;
+
+    memset(d, 0, sizeof(*d));
+    d->function = -1;
+    d->count    = 1;
+    d->width    = -1;
+    while(i < end && (tok(i, "*") || tok(i, "const") || tok(i, "volatile"))){
+        if(tok(i, "*")) d->pointer = 1;
+        i++;
+    }
+    if(i < end && tok(i, "(")){                                                 /* (*fn)(...), a pointer */
+        close = closing(i);
+        for(int k=i;k<close;k++){
+            if(isIdent(tokens[k])) strcpy(d->name, tokens[k]);
+        }
+        d->pointer = 1;
+        i = close + 1;
+    } else if(i < end && isIdent(tokens[i]) && !isWord(tokens[i], typeWords)){
+        strcpy(d->name, tokens[i]);
+        i++;
+    }
+    while(i < end){
+        if(tok(i, "__attribute__")){
+            i = closing(i + 1) + 1;
+        } else if(tok(i, "[")){
+            close = closing(i);
+            if(close == i + 1){
+                d->count = -1;                                                  /* from the initialiser */
+            } else if(d->count > 0){
+                int k = i + 1;
+
+                d->count *= evalCond(&k, close);
+            }
+            i = close + 1;
+        } else if(tok(i, "(")){
+            if(d->function < 0) d->function = i;
+            i = closing(i) + 1;
+        } else {
+            break;
+        }
+    }
+    if(i < end && tok(i, ":")){
+        i++;
+        d->width = evalCond(&i, end);
+    }
+    if(i < end && tok(i, "=")){
+        long elements = 1;
+
+        i++;
+        if(tok(i, "{")){
+            close = closing(i);
+            elements = close > i + 1;
+            for(int k=i+1, depth=0;k<close;k++){
+                if(tok(k, "(") || tok(k, "[") || tok(k, "{")) depth++;
+                else if(tok(k, ")") || tok(k, "]") || tok(k, "}")) depth--;
+                else if(!depth && tok(k, ",") && k + 1 < close) elements++;
+            }
+            i = close + 1;
+        } else if(tokens[i][0] == '"'){
+            elements = (long)strlen(tokens[i]) - 1;                             /* the quotes, less one for the 0 */
+        }
+        for(int depth=0;i<end;i++){
+            if(!depth && (tok(i, ",") || tok(i, ";"))) break;
+            if(tok(i, "(") || tok(i, "[") || tok(i, "{")) depth++;
+            else if(tok(i, ")") || tok(i, "]") || tok(i, "}")) depth--;
+        }
+        if(d->count < 0) d->count = elements;
+    }
+    if(d->count < 0) d->count = 0;
+    return i;
+
+}
+
+static void addGlobal(const char *name, unsigned size){
+
+    if(nglobals == MAX_SYMBOLS) return;
+    snprintf(globals[nglobals].name, sizeof(globals[nglobals].name), "%.*s", (int)sizeof(globals[nglobals].name) - 1, name);
+    globals[nglobals].size = size;
+    nglobals++;
+
+}
+
+static int layoutFunction(const struct spec *sp, const struct declarator *d, int body){
+
+    struct function *fn = &functions[nfunctions++];
+    unsigned params = 0;
+    unsigned ret = d->pointer ? 2 : sp->size;
+    int end = closing(body);
+    int close = closing(d->function);
+    int stmt = 1;
+
+    memset(fn, 0, sizeof(*fn));
+    strcpy(fn->name, d->name);
+    fn->isr = sp->isInterrupt || !strcmp(d->name, "sim_isr");                   /* HAL_ISR() on the host */
+    for(int i=d->function+1;i<close;){
+        struct spec ps;
+        struct declarator pd;
+
+        i = parseSpec(i, close, &ps);
+        if(i < 0) break;
+        i = parseDeclarator(i, close, &pd);
+        if(pd.pointer || pd.count != 1) params += 2;                            /* an array parameter is a pointer */
+        else if(!ps.isVoid) params += ps.size;
+        if(!tok(i, ",")) break;
+        i++;
+    }
+    fn->frame = params > ret ? params : ret;
+    for(int i=body+1;i<end;){
+        if(stmt && isWord(tokens[i], typeWords)){
+            struct spec ls;
+            struct declarator ld;
+
+            i = parseSpec(i, end, &ls);
+            while(i < end){
+                i = parseDeclarator(i, end, &ld);
+                if(ls.isStatic){
+                    char name[96];
+
+                    snprintf(name, sizeof(name), "%s.%s", fn->name, ld.name);
+                    addGlobal(name, sizeOf(&ls, &ld));
+                } else if(!ls.isExtern && !ls.isTypedef && ld.function < 0){
+                    fn->frame += sizeOf(&ls, &ld);
+                }
+                if(!tok(i, ",")) break;
+                i++;
+            }
+            stmt = 0;
+            continue;
+        }
+        stmt = tok(i, "{") || tok(i, "}") || tok(i, ";") || (tok(i, "(") && tok(i - 1, "for"));
+        i++;
+    }
+    for(int i=body+1;i<end;i++){
+        int known = 0;
+
+        if(!isIdent(tokens[i]) || !tok(i + 1, "(") || isWord(tokens[i], keywords) || isWord(tokens[i], typeWords)) continue;
+        for(int c=0;c<fn->ncalls;c++){
+            if(!strcmp(fn->calls[c], tokens[i])) known = 1;
+        }
+        if(!known && fn->ncalls < MAX_CALLS) strcpy(fn->calls[fn->ncalls++], tokens[i]);
+    }
+    return end + 1;
+
+}
+
+static void chainDepth(int f){
+
+    struct function *fn = &functions[f];
+
+    if(fn->state) return;                                                       /* done, or a recursion XC8 refuses anyway */
+    fn->state   = 1;
+    fn->deepest = -1;
+    fn->depth   = fn->frame;
+    for(int c=0;c<fn->ncalls;c++){
+        int callee = fn->callee[c];
+
+        if(callee < 0) continue;
+        chainDepth(callee);
+        if(functions[callee].state == 2 && fn->frame + functions[callee].depth > fn->depth){
+            fn->depth   = fn->frame + functions[callee].depth;
+            fn->deepest = callee;
+        }
+    }
+    fn->state = 2;
+
+}
+
+static int readLayout(FILE *f){
+
+    char *text = NULL, *line, *next;
+    char file[256], first[256] = "";
+    size_t len = 0, size = 0;
+    int c, inFirst = 0, i;
+
+    while((c = fgetc(f)) != EOF){                                               /* a curve table is one long line */
+        if(len + 1 >= size){
+            size = size ? 2 * size : 65536;
+            text = realloc(text, size);
+            if(!text) return 1;
+        }
+        text[len++] = (char)c;
+    }
+    if(!text) return 1;
+    text[len] = 0;
+    for(line=text;line && *line;line=next){
+        next = strchr(line, '\n');
+        if(next) *next++ = 0;
+        if(line[0] == '#'){                                                     /* a line marker, or a #pragma */
+            if(sscanf(line, "# %*d \"%255[^\"]\"", file) == 1){
+                if(!first[0]) strcpy(first, file);
+                inFirst = !strcmp(file, first);
+            }
+            continue;
+        }
+        if(inFirst) tokenize(line);
+    }
+    free(text);
+    if(!ntokens) return 1;
+    for(i=0;i<ntokens;){
+        struct spec sp;
+        struct declarator d;
+        int j = parseSpec(i, ntokens, &sp);
+
+        if(j < 0){
+            i++;
+            continue;
+        }
+        i = j;
+        while(i < ntokens){
+            j = parseDeclarator(i, ntokens, &d);
+            if(d.function >= 0 && tok(j, "{") && nfunctions < MAX_FUNCTIONS){
+                i = layoutFunction(&sp, &d, j);
+                break;
+            }
+            if(d.name[0] && d.function < 0 && !sp.isTypedef && !sp.isExtern && !(sp.isConst && !d.pointer)){
+                addGlobal(d.name, sizeOf(&sp, &d));                             /* a const is in flash */
+            }
+            i = j > i ? j : i + 1;
+            if(!tok(i, ",")) break;
+            i++;
+        }
+    }
+    mainStack = isrStack = -1;
+    for(int f=0;f<nfunctions;f++){
+        for(int c=0;c<functions[f].ncalls;c++){
+            functions[f].callee[c] = -1;
+            for(int g=0;g<nfunctions;g++){
+                if(!strcmp(functions[f].calls[c], functions[g].name)) functions[f].callee[c] = g;
+            }
+        }
+        if(functions[f].isr) isrStack = f;
+        if(!strcmp(functions[f].name, "main") || !strcmp(functions[f].name, "firmware_main")) mainStack = f;
+    }
+    ramTotal = 0;
+    for(int g=0;g<nglobals;g++){
+        ramTotal += globals[g].size;
+    }
+    if(mainStack >= 0){
+        chainDepth(mainStack);
+        ramTotal += functions[mainStack].depth;
+    }
+    if(isrStack >= 0){
+        chainDepth(isrStack);
+        ramTotal += functions[isrStack].depth + PIC_ISR_SAVE;
+    }
+    ramFrom = FROM_SOURCE;
+    return 0;
+
+}
+
+static void printChain(const char *root, int f){
+
+    printf("  %-24s %6s %6u ", root, "", f >= 0 ? functions[f].depth : 0);
+    for(;f>=0;f=functions[f].deepest){
+        printf(" %s %u", functions[f].name, functions[f].frame);
+    }
+    printf("\n");
+
+}
+
+static const char *functionName(const struct symbol *s){
+
+    if(psects[s->psect].space != SPACE_CODE) return NULL;
+    if(s->name[0] == '_' && s->name[1] != '_') return s->name + 1;
+    if(!strncmp(s->name, "i1_", 3)) return s->name;                             /* called from the interrupt as well, a copy */
+    return NULL;
+
+}
+
+static unsigned functionRam(const char *name){
+
+    char param[64], autos[64];
+    unsigned ram = 0;
+
+    snprintf(param, sizeof(param), "?_%s", name);
+    snprintf(autos, sizeof(autos), "??_%s", name);
+    for(int i=0;i<nsymbols;i++){
+        if(!strcmp(symbols[i].name, param) || !strcmp(symbols[i].name, autos)) ram += symbols[i].size;
+    }
+    return ram;
+
+}
+
+static int isGlobal(const struct symbol *s){
+
+    return psects[s->psect].space == SPACE_DATA && s->name[0] == '_' && s->name[1] != '_'
+           && strncmp(psects[s->psect].name, "cstack", 6);
+
+}
+
+static void report(void){
+
+    const char *name;
+
+    if(nsymbols){
+        printf("  %-24s %6s %6s\n", "function", "words", "ram");
+        for(int i=0;i<nsymbols;i++){
+            if((name = functionName(&symbols[i]))){
+                printf("  %-24s %6u %6u\n", name, symbols[i].size, functionRam(name));
+            }
+        }
+        printf("  %-24s %6s %6s\n", "global", "", "bytes");
+        for(int i=0;i<nsymbols;i++){
+            if(isGlobal(&symbols[i])){
+                printf("  %-24s %6s %6u\n", symbols[i].name + 1, "", symbols[i].size);
+            }
+        }
+    }
+    if(ramFrom == FROM_SOURCE){
+        printf("  %-24s %6s %6s  calls\n", "function", "words", "ram");
+        for(int f=0;f<nfunctions;f++){
+            printf("  %-24s %6s %6u ", functions[f].name, "-", functions[f].frame);
+            for(int c=0;c<functions[f].ncalls;c++){
+                if(functions[f].callee[c] >= 0) printf(" %s", functions[f].calls[c]);
+            }
+            printf("\n");
+        }
+        printf("  %-24s %6s %6s\n", "global", "", "bytes");
+        for(int g=0;g<nglobals;g++){
+            printf("  %-24s %6s %6u\n", globals[g].name, "", globals[g].size);
+        }
+        printf("  %-24s %6s %6s  deepest chain, frame per function\n", "compiled stack", "", "bytes");
+        printChain("main()", mainStack);
+        printChain("interrupt", isrStack);
+        printf("  %-24s %6s %6d\n", "interrupt save", "", isrStack >= 0 ? PIC_ISR_SAVE : 0);
+    }
+    if(flashFrom){
+        printf("flash %u of %d words (%.1f%%)  ", flashTotal, PIC_FLASH_WORDS, 100.0 * flashTotal / PIC_FLASH_WORDS);
+    }
+    if(ramFrom){
+        printf("ram %u of %d bytes (%.1f%%)%s", ramTotal, PIC_RAM_BYTES, 100.0 * ramTotal / PIC_RAM_BYTES,
+               ramFrom == FROM_SOURCE ? ", laid out from the source" : "");
+    }
+    printf("\n");
+
+}
+
+static int lookup(const char *kind, const char *name, unsigned *value){
+
+    const char *fn;
+
+    if(!strcmp(name, "total")){
+        *value = kind[0] == 'f' ? flashTotal : ramTotal;
+        return 0;
+    }
+    if(kind[0] == 'r' && ramFrom == FROM_SOURCE){
+        for(int f=0;f<nfunctions;f++){
+            if(!strcmp(functions[f].name, name)){
+                *value = functions[f].frame;
+                return 0;
+            }
+        }
+        for(int g=0;g<nglobals;g++){
+            if(!strcmp(globals[g].name, name)){
+                *value = globals[g].size;
+                return 0;
+            }
+        }
+        return 1;
+    }
+    for(int i=0;i<nsymbols;i++){
+        fn = functionName(&symbols[i]);
+        if(fn && !strcmp(fn, name)){
+            *value = kind[0] == 'f' ? symbols[i].size : functionRam(name);
+            return 0;
+        }
+        if(kind[0] == 'r' && isGlobal(&symbols[i]) && !strcmp(symbols[i].name + 1, name)){
+            *value = symbols[i].size;
+            return 0;
+        }
+    }
+    return 1;
+
+}
+
+static int checkBudget(const char *path){
+
+    FILE *f = fopen(path, "r");
+    char line[128], kind[16], name[48];
+    unsigned limit, value;
+    int fail = 0;
+
+    if(!f){
+        perror(path);
+        return 1;
+    }
+    printf("budget %s\n", path);
+    while(fgets(line, sizeof(line), f)){
+        if(sscanf(line, "%15s", kind) != 1 || (strcmp(kind, "flash") && strcmp(kind, "ram"))) continue;
+        if(sscanf(line, "%*s %47s %u", name, &limit) != 2){
+            printf("  bad line: %s", line);
+            fail = 1;
+            continue;
+        }
+        if(kind[0] == 'f' ? flashFrom == FROM_NONE || (flashFrom == FROM_HEX && strcmp(name, "total")) : ramFrom == FROM_NONE){
+            printf("  %-5s %-24s FAIL, not known without %s\n", kind, name,
+                   kind[0] == 'f' ? (strcmp(name, "total") || ramFrom == FROM_SOURCE ? "the .map" : "the .map or the .hex")
+                                  : (flashFrom == FROM_HEX ? "the .map" : "the .map or the .i"));
+            fail = 1;                                                           /* unchecked is not within budget */
+            continue;
+        }
+        if(lookup(kind, name, &value)){
+            printf("  %-5s %-24s not in this build\n", kind, name);
+            fail = 1;
+            continue;
+        }
+        printf("  %-5s %-24s %6u  limit %6u  %s\n", kind, name, value, limit, value <= limit ? "ok" : "OVER");
+        if(value > limit) fail = 1;
+    }
+    fclose(f);
+    return fail;
+
+}
+
+int main(int argc, char **argv){
+
+    const char *budget = NULL;
+    const char *dot;
+    const char *hex = NULL;
+    const char *source = NULL;
+    FILE *f;
+    int first = 1;
+    int bad;
+
+    if(argc > 2 && !strcmp(argv[1], "-b")){
+        budget = argv[2];
+        first  = 3;
+    }
+    if(first >= argc){
+        fprintf(stderr, "usage: %s [-b budget] file.map|file.hex|file.i...\n", argv[0]);
+        return 1;
+    }
+    for(int i=first;i<argc;i++){
+        dot = strrchr(argv[i], '.');
+        if(dot && !strcmp(dot, ".hex")) hex    = argv[i];
+        if(dot && !strcmp(dot, ".i"))   source = argv[i];
+    }
+    if(hex && source){
+        fprintf(stderr, "%s with %s: not known to be one build, give the .map of the build the .hex came from\n",
+                hex, source);
+        return 1;
+    }
+    for(int i=first;i<argc;i++){
+        f = fopen(argv[i], "r");
+        if(!f){
+            perror(argv[i]);
+            return 1;
+        }
+        dot = strrchr(argv[i], '.');
+        if(dot && !strcmp(dot, ".hex"))     bad = readHex(f);
+        else if(dot && !strcmp(dot, ".i"))  bad = readLayout(f);
+        else                                bad = readMap(f);
+        fclose(f);
+        if(bad){
+            fprintf(stderr, "%s: not an XC8 map, an Intel HEX or a preprocessed C file\n", argv[i]);
+            return 1;
+        }
+    }
+    report();
+    if(budget && checkBudget(budget)) return 1;
+    return 0;
+
+}
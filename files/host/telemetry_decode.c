@@ -0,0 +1,375 @@
+/*
+ * File:   telemetry_decode.c
+ * Author: George Nikolaidis
+ *
+ * Host side decoder for the telemetry frames of nmain.c, see telemetry.h.
+ * Reads any number of boards at once, one file, fifo, pty or serial port
+ * per board, with poll() in a single thread: whichever has bytes is read.
+ * The frames are parsed where read() put them, a frame is a pointer into
+ * the buffer of its board, only the few bytes of a frame cut by a read are
+ * moved to the front for the next one. A frame is a TELEMETRY_SYNC byte with
+ * TELEMETRY_FRAME - 1 bytes after it that sum to 0 with it, anything else is
+ * skipped a byte at a time until one lines up.
+ *
+ * usage: fanctl-telemetry [-q] file...
+ *        fanctl-telemetry -b [boards] [frames]
+ *   -q  no line per frame, only what each board sent in the end
+ *   -b  how many frames a second the parser takes from that many boards,
+ *       default 64 boards, 100000 frames each, built in memory with junk
+ *       bytes and broken frames in between
+ *
+ * Build with the same -DPWM_FREQUENCY as the firmware, the duty in % needs
+ * it:
+ *     gcc -std=c99 -O2 -Wall -o fanctl-telemetry files/host/telemetry_decode.c
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../fan_curve.h"
+#include "../telemetry.h"
+
+#define STREAM_BUFFER       4096                                                /* one read() */
+#define MAX_STREAMS         1024
+#define BENCH_CHUNK         512                                                 /* bytes a board gives per round, as a read() would */
+
+struct stream {
+    const char *name;
+    int      fd;
+    size_t   len;                                                               /* bytes in buf not parsed yet */
+    int      lastSeq;                                                           /* -1 before the first frame */
+    uint32_t frames;
+    uint32_t gaps;                                                              /* frames missing by the sequence number */
+    uint32_t skipped;                                                           /* bytes that were no frame */
+    int      lastTemp;                                                          /* of the last frame, for the summary */
+    unsigned lastDuty;
+    uint8_t  buf[STREAM_BUFFER + TELEMETRY_FRAME];
+};
+
+static struct stream *streams;
+static int nstreams;
+static int quiet;
+
+/* FRAME FIELDS, straight from the bytes as received */
+static int frameTemp16(const uint8_t *f){
+
+    return (int16_t)(f[TELEMETRY_TEMP] | (f[TELEMETRY_TEMP + 1] << 8));        /* 1/16 C */
+
+}
+
+static unsigned frameDuty(const uint8_t *f){
+
+    return f[TELEMETRY_DUTY] | ((f[TELEMETRY_DUTY + 1] & TELEMETRY_DUTY_HIGH) << 8);
+
+}
+
+static unsigned frameFlags(const uint8_t *f){
+
+    return f[TELEMETRY_DUTY + 1];
+
+}
+
+static unsigned frameRpm(const uint8_t *f){
+
+    unsigned period = f[TELEMETRY_TACH] | (f[TELEMETRY_TACH + 1] << 8);
+
+    return period ? (unsigned)(TELEMETRY_TACH_RPM / period) : 0;
+
+}
+
+static int frameValid(const uint8_t *f){
+
+    uint8_t sum = 0;
+
+    for(int i=0;i<TELEMETRY_FRAME;i++) sum += f[i];
+    return f[0] == TELEMETRY_SYNC && sum == 0;
+
+}
+
+static void printFrame(const struct stream *s, const uint8_t *f){
+
+    unsigned flags = frameFlags(f);
+    int      temp  = frameTemp16(f);
+
+    printf("%-16s seq %3u  %s%3d.%02dC  duty %5.1f%%  ", s->name, f[TELEMETRY_SEQ], temp < 0 ? "-" : " ",
+           abs(temp) / 16, abs(temp) % 16 * 100 / 16, frameDuty(f) * 100.0 / PWM_DUTY_MAX);
+    if(flags & TELEMETRY_HAS_TACH) printf("%5u rpm  ", frameRpm(f));
+    else                           printf("    - rpm  ");
+    printf("%d bits  step %2u  errors %3u%s%s\n", 9 + (int)((flags & TELEMETRY_LEVEL) >> TELEMETRY_LEVEL_SHIFT),
+           f[TELEMETRY_STEP], f[TELEMETRY_ERRORS], flags & TELEMETRY_LOST ? "  SENSOR LOST" : "",
+           flags & TELEMETRY_STALL ? "  FAN STALL" : "");
+
+}
+
+static void onFrame(struct stream *s, const uint8_t *f){
+
+    unsigned seq = f[TELEMETRY_SEQ];
+
+    if(s->lastSeq >= 0) s->gaps += (seq - (unsigned)s->lastSeq - 1) & 0xFF;
+    s->lastSeq  = (int)seq;
+    s->lastTemp = frameTemp16(f);
+    s->lastDuty = frameDuty(f);
+    s->frames++;
+    if(!quiet) printFrame(s, f);
+
+}
+
+/* PARSER
+ * Returns how many bytes of p it is done with, the rest is the start of a
+ * frame that has not all arrived yet. */
+static size_t parse(struct stream *s, const uint8_t *p, size_t len){
+
+    size_t pos = 0;
+    const uint8_t *sync;
+
+    while(len - pos >= TELEMETRY_FRAME){
+        if(p[pos] != TELEMETRY_SYNC){
+            sync = memchr(p + pos, TELEMETRY_SYNC, len - pos);
+            if(!sync){
+                s->skipped += (uint32_t)(len - pos);
+                return len;
+            }
+            s->skipped += (uint32_t)(sync - (p + pos));
+            pos = (size_t)(sync - p);
+            continue;
+        }
+        if(frameValid(p + pos)){
+            onFrame(s, p + pos);                                                /* in place, no copy */
+            pos += TELEMETRY_FRAME;
+        } else {
+            s->skipped++;                                                       /* a sync byte inside something else */
+            pos++;
+        }
+    }
+    return pos;
+
+}
+
+static void feed(struct stream *s, size_t got){
+
+    size_t used;
+
+    s->len += got;
+    used    = parse(s, s->buf, s->len);
+    s->len -= used;
+    if(s->len) memmove(s->buf, s->buf + used, s->len);                          /* at most TELEMETRY_FRAME - 1 bytes */
+
+}
+
+static void streamInit(struct stream *s, const char *name, int fd){
+
+    memset(s, 0, offsetof(struct stream, buf));
+    s->name     = name;
+    s->fd       = fd;
+    s->lastSeq  = -1;
+
+}
+
+static void summary(void){
+
+    for(int i=0;i<nstreams;i++){
+        struct stream *s = &streams[i];
+        printf("%-16s frames %u  missing %u  bytes skipped %u", s->name, s->frames, s->gaps, s->skipped);
+        if(s->frames){
+            printf("  last %.2fC duty %.1f%%", s->lastTemp / 16.0, s->lastDuty * 100.0 / PWM_DUTY_MAX);
+        }
+        printf("\n");
+    }
+
+}
+
+/* STREAMS */
+static int decodeFiles(char **paths, int n){
+
+    struct pollfd *pfd = calloc((size_t)n, sizeof(*pfd));
+    int live = 0;
+    ssize_t got;
+
+    if(!pfd) return 1;
+    for(int i=0;i<n;i++){
+        int fd = open(paths[i], O_RDONLY | O_NOCTTY);                          /* a fifo waits here for its writer */
+        if(fd < 0){
+            perror(paths[i]);
+            free(pfd);
+            return 1;
+        }
+        streamInit(&streams[i], paths[i], fd);
+        pfd[i].fd       = fd;
+        pfd[i].events   = POLLIN;
+        live++;
+    }
+    nstreams = n;
+    while(live){
+        if(poll(pfd, (nfds_t)n, -1) < 0){
+            if(errno == EINTR) continue;
+            perror("poll");
+            break;
+        }
+        for(int i=0;i<n;i++){
+            struct stream *s = &streams[i];
+            if(pfd[i].fd < 0 || !pfd[i].revents) continue;
+            got = read(s->fd, s->buf + s->len, STREAM_BUFFER);
+            if(got > 0){
+                feed(s, (size_t)got);
+            } else if(got == 0 || (errno != EAGAIN && errno != EINTR)){
+                close(s->fd);                                                   /* end of file, the writer went away, EIO on a pty */
+                pfd[i].fd = -1;
+                live--;
+            }
+        }
+    }
+    free(pfd);
+    return 0;
+
+}
+
+/* BENCHMARK
+ * Every board gets its own stream of frames in memory, a temperature ramp,
+ * with 1 frame in 97 broken by a bit flip and a few junk bytes after 1 in
+ * 89, then the boards are taken in turn BENCH_CHUNK bytes at a time, the
+ * way poll() hands them over. The copy into the buffer of the board stands
+ * for the copy read() makes and is counted. */
+static uint32_t benchRandom(uint32_t *state){
+
+    *state ^= *state << 13;                                                     /* xorshift32 */
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+
+}
+
+static size_t benchStream(uint8_t *out, int board, int frames, uint32_t *good){
+
+    uint32_t rng = 0x9E3779B9u ^ (uint32_t)board;
+    size_t   len = 0;
+    uint8_t *f;
+    uint8_t  sum;
+    int      temp;
+    unsigned duty;
+
+    *good = 0;
+    for(int i=0;i<frames;i++){
+        f       = out + len;
+        temp    = (25 + board % 20) * 16 + (i % 640) - 320;
+        duty    = (unsigned)(i * 7 + board) % (PWM_DUTY_MAX + 1);
+        f[0]    = TELEMETRY_SYNC;
+        f[TELEMETRY_SEQ]        = (uint8_t)i;
+        f[TELEMETRY_TEMP]       = (uint8_t)temp;
+        f[TELEMETRY_TEMP + 1]   = (uint8_t)(temp >> 8);
+        f[TELEMETRY_DUTY]       = (uint8_t)duty;
+        f[TELEMETRY_DUTY + 1]   = (uint8_t)((duty >> 8) | ((i & 3) << TELEMETRY_LEVEL_SHIFT) | TELEMETRY_HAS_TACH);
+        f[TELEMETRY_TACH]       = (uint8_t)(5000 + i);
+        f[TELEMETRY_TACH + 1]   = (uint8_t)((5000 + i) >> 8);
+        f[TELEMETRY_ERRORS]     = (uint8_t)(i / 1000);
+        f[TELEMETRY_STEP]       = (uint8_t)(i % FAN_LUT_SIZE);
+        sum = 0;
+        for(int j=0;j<TELEMETRY_SUM;j++) sum += f[j];
+        f[TELEMETRY_SUM]        = (uint8_t)-sum;
+        len += TELEMETRY_FRAME;
+        if(i % 97 == 96){
+            f[1 + benchRandom(&rng) % (TELEMETRY_FRAME - 1)] ^= (uint8_t)(1u << (benchRandom(&rng) & 7));
+        } else {
+            (*good)++;
+        }
+        if(i % 89 == 88){
+            for(int j=(int)(benchRandom(&rng) % 5);j>=0;j--){
+                out[len++] = (uint8_t)benchRandom(&rng);                        /* line noise, a sync byte now and then */
+            }
+        }
+    }
+    return len;
+
+}
+
+static int bench(int boards, int frames){
+
+    uint8_t **src   = calloc((size_t)boards, sizeof(*src));
+    size_t   *size  = calloc((size_t)boards, sizeof(*size));
+    size_t   *pos   = calloc((size_t)boards, sizeof(*pos));
+    uint64_t bytes  = 0;
+    uint64_t found  = 0;
+    uint64_t expect = 0;
+    uint32_t good;
+    struct timespec t0, t1;
+    double   seconds;
+    int      left;
+
+    if(!src || !size || !pos) return 1;
+    for(int i=0;i<boards;i++){
+        src[i] = malloc((size_t)frames * (TELEMETRY_FRAME + 6));
+        if(!src[i]) return 1;
+        size[i] = benchStream(src[i], i, frames, &good);
+        bytes  += size[i];
+        expect += good;
+        streamInit(&streams[i], "bench", -1);
+    }
+    nstreams = boards;
+    quiet    = 1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    do {
+        left = 0;
+        for(int i=0;i<boards;i++){
+            struct stream *s = &streams[i];
+            size_t n = size[i] - pos[i];
+            if(!n) continue;
+            if(n > BENCH_CHUNK) n = BENCH_CHUNK;
+            memcpy(s->buf + s->len, src[i] + pos[i], n);                        /* what read() would do */
+            pos[i] += n;
+            feed(s, n);
+            left += pos[i] < size[i];
+        }
+    } while(left);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    seconds = (double)(t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    for(int i=0;i<boards;i++){
+        found += streams[i].frames;
+        free(src[i]);
+    }
+    printf("%d boards, %llu bytes, %llu good frames of %llu, found %llu\n", boards, (unsigned long long)bytes,
+           (unsigned long long)expect, (unsigned long long)boards * frames, (unsigned long long)found);
+    printf("%.3f s  %.1f M frames/s  %.0f MB/s  %.1f ns per frame\n", seconds, found / seconds / 1e6,
+           bytes / seconds / 1e6, seconds * 1e9 / found);
+    free(src);
+    free(size);
+    free(pos);
+    return found == expect ? 0 : 1;
+
+}
+
+int main(int argc, char **argv){
+
+    int first = 1;
+
+    streams = calloc(MAX_STREAMS, sizeof(*streams));
+    if(!streams) return 1;
+    if(argc > 1 && !strcmp(argv[1], "-b")){
+        int boards = argc > 2 ? atoi(argv[2]) : 64;
+        int frames = argc > 3 ? atoi(argv[3]) : 100000;
+        if(boards < 1 || boards > MAX_STREAMS || frames < 1){
+            fprintf(stderr, "boards 1 to %d, frames 1 and up\n", MAX_STREAMS);
+            return 1;
+        }
+        return bench(boards, frames);
+    }
+    if(argc > 1 && !strcmp(argv[1], "-q")){
+        quiet = 1;
+        first = 2;
+    }
+    if(first >= argc || argc - first > MAX_STREAMS){
+        fprintf(stderr, "usage: %s [-q] file...\n       %s -b [boards] [frames]\n", argv[0], argv[0]);
+        return 1;
+    }
+    if(decodeFiles(argv + first, argc - first)) return 1;
+    summary();
+    return 0;
+
+}
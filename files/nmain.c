@@ -16,7 +16,7 @@
 
 /* CONFIG */
 #pragma config FOSC = INTOSCIO                                                  // Oscillator Selection bits (INTOSCIO oscillator: I/O function on GP4/OSC2/CLKOUT pin, I/O function on GP5/OSC1/CLKIN)
-#pragma config WDTE = OFF                                                       // Watchdog Timer Enable bit (WDT disabled and can be enabled by SWDTEN bit of the WDTCON register)
+#pragma config WDTE = ON                                                        // Watchdog Timer Enable bit (WDT enabled, wakes the core from SLEEP between samples, resets it when the 1-wire engine stalls)
 #pragma config PWRTE = ON                                                       // Power-up Timer Enable bit (PWRT disabled)
 #pragma config MCLRE = OFF                                                      // MCLR Pin Function Select bit (MCLR pin function is digital input, MCLR internally tied to VDD)
 #pragma config CP = OFF                                                         // Code Protection bit (Program memory code protection is disabled)
@@ -26,41 +26,62 @@
                                                                                 // #pragma config statements should precede project file includes.
                                                                                 // Use project enums instead of #define for ON and OFF.
 
-#include <xc.h>
+#include "hal.h"
+#include "fan_curve.h"
+#include "telemetry.h"
 #define _XTAL_FREQ 8000000
-#define DISABLE_PWM_SERVICE()               (CCP1CON            = 0x0)
-#define ENABLE_DIGITAL_IO_PINS()            (ANSEL = 0X0)
-#define GPIF_INT_INTERRUPT_FLAG_CLEAR()     (INTCONbits.GPIF    = 0)
-#define TMR2_OFF()                          (T2CONbits.T2ON     = 0)
-#define TMR2_ON()                           (T2CONbits.T2ON     = 1)
-#define SET_PRESCALER_1()                   (T2CON = 0x0)
-#define ENABLE_CCP1_OUTPUT_DRIVE()          (TRISAbits.TRISIO2  = 0)
-#define DISABLE_CCP1_OUTPUT_DRIVE()         (TRISAbits.TRISIO2  = 1)
-#define SEND_LOW_CLOCK_PULSE()              (GPIObits.GP2       = 0)
-#define LED_ON()                            (GPIObits.GP5       = 1)
-#define LED_OFF()                           (GPIObits.GP5       = 0)
-#define SET_GPIO0_LOW()                     (GPIObits.GP0       = 0)
-#define SET_GPIO1_LOW()                     (GPIObits.GP1       = 0)
-#define SET_GPIO4_LOW()                     (GPIObits.GP4       = 0)
-#define SET_GPIO5_LOW()                     (GPIObits.GP5       = 0)
-#define SET_OPTION_REG()                    (OPTION_REG         = 0x80)
-#define SET_INTCON()                        (INTCON             = 0xC8)
-#define SET_PR2()                           (PR2                = 0x4F)         /* for 25Khz 0x4F, for 10khz 0xC7 */
-#define SET_CCP1CON()                       (CCP1CON            = 0xC)
-#define SET_CCPR1L()                        (CCPR1L             = 0xC)          /* for 25Khz 15% 0xC, for 10khz 1E */
-#define SET_PIR1()                          (PIR1               = 0x0)
-#define SET_PORTA()                         (TRISA              = 0xC)
-
-#define MASTER_LOW()                        (GPIObits.GP4       = 0x0)
-#define MASTER_HIGH()                       (GPIObits.GP4       = 0x1)
-#define RELEASE_BUS()                       (TRISAbits.TRISIO4  = 0x1)
-#define MASTER_OUT()                        (TRISAbits.TRISIO4  = 0x0)
-#define MASTER_READ_BIT                      GPIObits.GP4
-
-#define TMR1_CLEAR_FLAG_INT()               (PIR1bits.TMR1IF    = 0x0)
-#define ENABLE_TMR1_INT()                   (PIE1bits.TMR1IE    = 0x1)
-
-#define LED_TOGGLE()             do { GPIObits.GP5 = ~GPIObits.GP5; } while(0)
+#define DISABLE_PWM_SERVICE()               HAL_REG_WRITE(CCP1CON, 0x0)
+#define ENABLE_DIGITAL_IO_PINS()            HAL_REG_WRITE(ANSEL, 0X0)
+#define GPIF_INT_INTERRUPT_FLAG_CLEAR()     HAL_BIT_WRITE(INTCON, GPIF, 0)
+#define TMR2_OFF()                          HAL_BIT_WRITE(T2CON, T2ON, 0)
+#define TMR2_ON()                           HAL_BIT_WRITE(T2CON, T2ON, 1)
+#define SET_PRESCALER_1()                   HAL_REG_WRITE(T2CON, 0x0)
+#define ENABLE_CCP1_OUTPUT_DRIVE()          HAL_BIT_WRITE(TRISA, TRISIO2, 0)
+#define DISABLE_CCP1_OUTPUT_DRIVE()         HAL_BIT_WRITE(TRISA, TRISIO2, 1)
+#define SEND_LOW_CLOCK_PULSE()              HAL_BIT_WRITE(GPIO, GP2, 0)
+#define SEND_HIGH_CLOCK_PULSE()             HAL_BIT_WRITE(GPIO, GP2, 1)
+#define LED_ON()                            HAL_BIT_WRITE(GPIO, GP5, 1)
+#define LED_OFF()                           HAL_BIT_WRITE(GPIO, GP5, 0)
+#define SET_GPIO0_LOW()                     HAL_BIT_WRITE(GPIO, GP0, 0)
+#define SET_GPIO1_LOW()                     HAL_BIT_WRITE(GPIO, GP1, 0)
+#define SET_GPIO4_LOW()                     HAL_BIT_WRITE(GPIO, GP4, 0)
+#define SET_GPIO5_LOW()                     HAL_BIT_WRITE(GPIO, GP5, 0)
+#define SET_OPTION_REG()                    HAL_REG_WRITE(OPTION_REG, OPTION_GPPU | 0x0F)
+#define SET_WDT_PRESCALER(ps)               HAL_REG_WRITE(OPTION_REG, OPTION_GPPU | 0x08 | (ps))  /* PSA to the WDT, 18ms << ps */
+#define SET_INTCON()                        HAL_REG_WRITE(INTCON, FAN_TACH ? 0xC8 : 0xC0)  /* GIE, PEIE, GPIE for the tach, never INTE */
+#define SET_PR2()                           HAL_REG_WRITE(PR2, PWM_PR2)         /* for 25Khz 0x4F, for 10khz 0xC7, see fan_curve.h */
+#define SET_CCP1CON()                       HAL_REG_WRITE(CCP1CON, FAN_CCP1CON(FAN_CURVE_T0))
+#define SET_CCPR1L()                        HAL_REG_WRITE(CCPR1L, FAN_CCPR1L(FAN_CURVE_T0)) /* first step of the curve, 15% 0xC at 25Khz */
+#define SET_PIR1()                          HAL_REG_WRITE(PIR1, 0x0)
+#define SET_PORTA()                         HAL_REG_WRITE(TRISA, FAN_TACH ? 0xE : 0xC)
+#define SET_WPU()                           HAL_REG_WRITE(WPU, FAN_TACH ? 0x2 : 0x0)   /* pull-up for the open collector tach */
+#define SET_IOC()                           HAL_REG_WRITE(IOC, FAN_TACH ? 0x2 : 0x0)   /* interrupt on change on GP1 */
+#define TACH_READ_BIT                       HAL_BIT_READ(GPIO, GP1)
+#define PWM_DUTY()                          ((unsigned int)((HAL_REG_READ(CCPR1L) << 2) | ((HAL_REG_READ(CCP1CON) >> 4) & 0x3)))  /* CCPR1L:DC1B, the duty now */
+#define PWM_LOAD(duty)                      do { HAL_REG_WRITE(CCPR1L, (duty) >> 2); HAL_REG_WRITE(CCP1CON, 0x0C | (((duty) & 0x3) << 4)); } while(0)  /* DC1B<1:0> and PWM mode, taken at the next period */
+
+#define MASTER_LOW()                        HAL_BIT_WRITE(GPIO, GP4, 0x0)
+#define MASTER_HIGH()                       HAL_BIT_WRITE(GPIO, GP4, 0x1)
+#define RELEASE_BUS()                       HAL_BIT_WRITE(TRISA, TRISIO4, 0x1)
+#define MASTER_OUT()                        HAL_BIT_WRITE(TRISA, TRISIO4, 0x0)
+#define MASTER_READ_BIT                     HAL_BIT_READ(GPIO, GP4)
+
+#define TMR1_ON()                           HAL_BIT_WRITE(T1CON, TMR1ON, 1)
+#define TMR1_OFF()                          HAL_BIT_WRITE(T1CON, TMR1ON, 0)
+#define SET_T1CON()                         HAL_REG_WRITE(T1CON, 0x20)          /* 1:4, 2us per count */
+#define DISABLE_INTERRUPTS()                HAL_BIT_WRITE(INTCON, GIE, 0)
+#define ENABLE_INTERRUPTS()                 HAL_BIT_WRITE(INTCON, GIE, 1)
+#define TMR1_CLEAR_FLAG_INT()               HAL_BIT_WRITE(PIR1, TMR1IF, 0x0)
+#define TMR1_SET_FLAG_INT()                 HAL_BIT_WRITE(PIR1, TMR1IF, 0x1)
+#define TMR1_READ(high, low)                do { high = HAL_REG_READ(TMR1H); low = HAL_REG_READ(TMR1L); } while(high != HAL_REG_READ(TMR1H))  /* again if TMR1L rolled over between the two */
+#define ENABLE_TMR1_INT()                   HAL_BIT_WRITE(PIE1, TMR1IE, 0x1)
+#define TMR0_CLEAR_FLAG_INT()               HAL_BIT_WRITE(INTCON, T0IF, 0x0)
+#define ENABLE_TMR0_INT()                   HAL_BIT_WRITE(INTCON, T0IE, 0x1)
+#define DISABLE_TMR0_INT()                  HAL_BIT_WRITE(INTCON, T0IE, 0x0)
+#define TX_HIGH()                           HAL_BIT_WRITE(GPIO, GP0, 1)         /* line idle, stop bit */
+#define TX_LOW()                            HAL_BIT_WRITE(GPIO, GP0, 0)         /* start bit */
+
+#define LED_TOGGLE()             do { HAL_BIT_WRITE(GPIO, GP5, ~HAL_BIT_READ(GPIO, GP5)); } while(0)
 
                                                                                 //The below didn't work
                                                                                 //#define DELAY_RESET()            do { for(int i=0;i<960; i++); } while(0) /* delay for 480 us */
@@ -71,8 +92,105 @@
                                                                                 //#define WRITE_LOW_DELAY()        do { for(int i=0;i<180; i++); } while(0) /* delay for  90 us */
                                                                                 //#define DELAY_51us()             do { for(int i=0;i<102; i++); } while(0) /* delay for  51 us */
 
-#define WAIT_FOR_NEW_PWM_CYCLE() do { while(PIR1bits.TMR2IF != 1);  } while(0)
-#define DS18B20_BUSY()           do { while(GPIObits.GP4    != 1);  } while(0)
+#define WAIT_FOR_NEW_PWM_CYCLE() do { while(HAL_BIT_READ(PIR1, TMR2IF) != 1);  } while(0)
+
+#define OW_END                   0x0                                            /* 1-wire engine operations */
+#define OW_RESET                 0x1
+#define OW_WRITE                 0x2                                            /* followed by the byte to write */
+#define OW_READ                  0x3                                            /* followed by the number of bytes to read */
+#define OW_MATCH                 0x4                                            /* MATCH ROM of sensor owArg, SKIP ROM with one */
+#define OW_SEARCH                0x5                                            /* one SEARCH ROM pass, the ROM of sensor owArg */
+#define OW_WAIT                  0x6                                            /* bus idle for owArg OW_TICK_US ticks */
+#define OW_WRITE_3               0x7                                            /* owArg written 3 times */
+#define OW_SCRIPT_IDLE           0                                              /* owQueuePos once a transaction is done */
+#define OW_SCRIPT_CONVERT        1                                              /* where each transaction starts in owScript[] */
+#define OW_SCRIPT_CONFIG         7
+#define OW_SCRIPT_WAIT           14
+#define OW_SCRIPT_READ           16
+#define OW_SCRIPT_SEARCH         (OW_SCRIPT_READ + (OW_CRC ? 7 : 8))
+#define OW_DATA_CONFIG           2                                              /* owData.read[], TEMP LSB, TEMP MSB, CONFIG */
+
+#define OW_FETCH                 0x0                                            /* 1-wire engine phases */
+#define OW_PRESENCE              0x1
+#define OW_PRESENCE_SAMPLE       0x2
+#define OW_WRITE_SLOT            0x3
+#define OW_WRITE_RELEASE         0x4
+#define OW_READ_SLOT             0x5
+#define OW_SEARCH_ID             0x6
+#define OW_SEARCH_CMP            0x7
+#define OW_WAIT_TICK             0x8
+#define OW_PRESENCE_END          0x9                                            /* 4 bits, see ow */
+
+#define OW_TICK_US               16000                                          /* also the fan control period */
+#define OW_TMR1_US               2                                              /* Timer1 at 1:4, longest wait 131ms */
+#define OW_TICKS(ms)             (((ms) * 1000L + OW_TICK_US - 1) / OW_TICK_US) /* rounded up */
+#define WDT_AWAKE_PRESCALER      2                                              /* 72ms, 40ms with the WDT 45% fast, over a tick */
+
+#ifndef OW_CRC
+#define OW_CRC                   1                                              /* 1: CRC8 a bit per read slot, 2: a byte at a time
+                                                                                 * from a nibble table, 0: no check, as before */
+#endif
+#define OW_CRC_BIT_CYCLES        8                                              /* hand counted, XC8 free, see HAL_CYCLES() */
+#define OW_CRC_BYTE_CYCLES       32                                             /* hand counted, two RETLW table lookups */
+#define OW_CRC_BIT(bit)          do { if((owCrc ^ (bit)) & 0x01) owCrc = (owCrc >> 1) ^ 0x8C; else owCrc = owCrc >> 1; } while(0)  /* X^8 + X^5 + X^4 + 1, LSB first */
+
+#ifndef DS18B20_MAX_SENSORS
+#define DS18B20_MAX_SENSORS      1                                              /* 6 bytes of RAM more per sensor, 1 for the count */
+#endif
+#if DS18B20_MAX_SENSORS > 1
+#define SENSOR_COUNT             sensorCount
+#else
+#define SENSOR_COUNT             1                                              /* SKIP ROM, no ROM table */
+#endif
+#define DS18B20_READ_TRIES       3                                              /* a read that fails the check is repeated */
+#define DS18B20_LOST_SAMPLES     2                                              /* samples in a row without it, then the fail-safe */
+#define DS18B20_CONFIG(level)    (((level) << 5) | 0x1F)                        /* 0 R1 R0 11111, level 0..3 is 9..12 bits */
+#define DS18B20_CONV_TICKS(conf) (OW_TICKS(94) << (((conf) >> 5) & 0x3))        /* 93.75ms at 9 bits, doubling per bit */
+#define DS18B20_CONV_WDT(conf)   (4 + (((conf) >> 5) & 0x3))                    /* 288ms << R1R0, 3 times the conversion,
+                                                                                 * 158ms << R1R0 with the WDT 45% fast */
+
+#ifndef SAMPLING_ADAPTIVE
+#define SAMPLING_ADAPTIVE        1                                              /* 0: 9 bits and 2.3s between samples, as before */
+#endif
+#define SAMPLE_SLOWEST           3                                              /* 12 bits, 750ms + 1.15s between samples */
+#define SAMPLE_WDT_PRESCALER(level) ((SAMPLING_ADAPTIVE ? 3 : 4) + (level))     /* 18ms << 3 = 144ms */
+#define SAMPLE_WAIT_TICKS(level) (OW_TICKS(144) << (SAMPLE_WDT_PRESCALER(level) - 3))  /* as long as the WDT sleep, 2304ms fixed */
+#define SAMPLE_FAST_RATE         16                                             /* 1/16 C per slowest period, 1C and up is fast */
+#define SAMPLE_STABLE_RATE       2                                              /* 1/8 C and below is stable */
+#define SAMPLE_STABLE_COUNT      3                                              /* stable samples before the next slower level */
+#define SAMPLE_NO_READING        0x7FFF                                         /* no previous reading to compare with */
+#if SAMPLE_WAIT_TICKS(SAMPLE_SLOWEST) > 255
+#error "SAMPLE_WAIT_TICKS does not fit the OW_WAIT byte"
+#endif
+
+#ifndef TEMP_EMA_SHIFT
+#define TEMP_EMA_SHIFT           2                                              /* EMA weight 1/4 at 9 bits, 0 turns the filter off */
+#endif
+#define TEMP_EMA_BYPASS          16                                             /* Q8.4, 1C away from the EMA is a move, not noise */
+#define TEMP_SENSOR_LSB(level)   ((8 >> (level)) << TEMP_EMA_SHIFT)             /* one step of the reading, 0.5C at 9 bits, << K */
+
+#ifndef FAN_TACH
+#define FAN_TACH                 1                                              /* 0: open loop, the curve sets the duty, as before */
+#endif
+#define OPTION_GPPU              (FAN_TACH ? 0x00 : 0x80)                       /* GPIO pull-ups on for the tach */
+#define TACH_RPM                 (60000000L / (2 * OW_TMR1_US))                 /* 2 pulses per turn, rpm = TACH_RPM / period */
+#define TACH_PERIOD_MIN          (TACH_RPM / (2 * FAN_RPM_MAX))                 /* shorter is noise on the tach, not the fan */
+#define TACH_MAX_AGE             8                                              /* ticks, an edge older than 128ms is no period */
+#define TACH_STALL               64                                             /* ticks without an edge, 1s, the fan is stuck */
+#define FAN_RPM_DEADBAND         (FAN_RPM_MAX / 200)                            /* close enough, leave the duty alone */
+#define FAN_KP_SHIFT             2                                              /* duty += err / 4 */
+#define FAN_KI_SHIFT             10                                             /* duty += sum(err) / 1024, summed every 16ms */
+#define FAN_SUM_SHIFT            5                                              /* summed as err / 32, so the sum fits an int */
+#define FAN_DUTY_MAX             ((int)PWM_DUTY_MAX)
+#define FAN_DUTY_MIN             ((int)fanDutyMin)
+#define FAN_INTEGRAL_MAX         (FAN_DUTY_MAX << (FAN_KI_SHIFT - FAN_SUM_SHIFT))  /* enough to move the duty end to end */
+#if (TACH_RPM >> 16) >= TACH_PERIOD_MIN
+#error "TACH_RPM / TACH_PERIOD_MIN does not fit 16 bits, see fanControl()"
+#endif
+
+#define TX_TMR0_ADD              (256 - TELEMETRY_BIT_CYCLES + 2)               /* TMR0 += this, +2 for the cycles a write holds it */
+#define TX_SERVICE_CYCLES        12                                             /* hand counted, the C in txService() */
+#define TX_BYTE_CYCLES           24                                             /* and the byte fetched for a start bit */
 
                                                                                 /* Calculate the delay, ex. 60.000ns/500ns = 120 cycles, so 120 cycles of 500ns -> 60us */
 
@@ -96,108 +214,841 @@
                                                                                    100% duty cycle CCPR1L 01010000 50h 200dec 0xC8
                                                                                 */
 
-unsigned char pwmSelect                 = 0;
-unsigned char pwmDutyCycle[8]           = {0x0,0xC,0x18,0x24,0x30,0x3C,0x48,0x50}; /* for 10khz 0x1E,0x3C,0x5A,0x78,0x96,0xB4,0xC8 */
-unsigned char DS18B20_SKIP              = 0xCC;                                 /* 11001100 */
-unsigned char DS18B20_READ_SCRATCHPAD   = 0xBE;                                 /* 10111110 */
-unsigned char DS18B20_WRITE_SCRATCHPAD  = 0x4E;                                 /* 01001110 */
-unsigned char DS18B20_COPY              = 0x48;                                 /* 01001000 */
-unsigned char DS18B20_CONV              = 0x44;                                 /* 01000100 */
-unsigned char DS18B20_9BIT_RESOLUTION   = 0x1F;                                 /* 00011111 */
-unsigned char tmpBit                    = 0;
-unsigned char configByte                = 0;
-unsigned char tempLSB                   = 0;
-unsigned char tempMSB                   = 0;
-unsigned char posNegTemp                = 1;
-int convertedTemp                       = 0;
-
-
-
-/* DS18B20 FUNCTIONS */
-void sendReset(){
-    
-    MASTER_OUT();                                                               /* Make PIN - 3 as output */
-    MASTER_LOW();                                                               /* Send LOW */
-    __delay_us(480);                                                            /* Delay for 480 us */ 
-    RELEASE_BUS();                                                              /* Make PIN - 3 as input to be read to receive the presence from DS18B20 */
-    __delay_us(120);                                                            /* Wait 120 us and read the presence */
-    DS18B20_BUSY();                                                             /* check if BUS is busy (low) */ 
-    
-}
+HAL_RAM unsigned char pwmSelect         = FAN_CURVE_T0 - FAN_LUT_BASE;          /* as set by SET_CCPR1L(), the first step of the curve */
+                                                                                /* const tables and commands are kept in flash, RAM is
+                                                                                 * 64 bytes and the ROM table needs 6 bytes per sensor */
+HAL_ROM unsigned char fanCurveCcpr1l[FAN_LUT_SIZE]  = { FAN_LUT(FAN_CCPR1L) };  /* duty per degree from FAN_LUT_BASE, see fan_curve.h */
+HAL_ROM unsigned char fanCurveCcp1con[FAN_LUT_SIZE] = { FAN_LUT(FAN_CCP1CON) };
+#define DS18B20_SKIP             0xCC                                           /* 11001100 */
+#define DS18B20_MATCH            0x55                                           /* 01010101 */
+#define DS18B20_SEARCH           0xF0                                           /* 11110000 */
+#define DS18B20_READ_SCRATCHPAD  0xBE                                           /* 10111110 */
+#define DS18B20_WRITE_SCRATCHPAD 0x4E                                           /* 01001110 */
+#define DS18B20_CONV             0x44                                           /* 01000100 */
+#define DS18B20_FAMILY           0x28                                           /* ROM byte 0, the same on every DS18B20 */
+HAL_ROM unsigned char owScript[]        = {                                     /* the transactions, fixed but for owArg */
+    OW_END,                                                                     /* OW_SCRIPT_IDLE, no transaction starts at 0 */
+    OW_RESET, OW_WRITE, DS18B20_SKIP, OW_WRITE, DS18B20_CONV, OW_END,           /* OW_SCRIPT_CONVERT, all sensors at once */
+    OW_RESET, OW_WRITE, DS18B20_SKIP, OW_WRITE, DS18B20_WRITE_SCRATCHPAD,       /* OW_SCRIPT_CONFIG, owArg into TH, TL and CONF */
+    OW_WRITE_3, OW_END,
+    OW_WAIT, OW_END,                                                            /* OW_SCRIPT_WAIT */
+    OW_RESET, OW_MATCH, OW_WRITE, DS18B20_READ_SCRATCHPAD,                      /* OW_SCRIPT_READ, sensor owArg */
+#if OW_CRC
+    OW_READ, 9, OW_END,                                                         /* all of it, the CRC is the last byte */
+#else
+    OW_READ, 5, OW_RESET, OW_END,                                               /* a RESET to stop reading the scratchpad */
+#endif
+#if DS18B20_MAX_SENSORS > 1
+    OW_RESET, OW_WRITE, DS18B20_SEARCH, OW_SEARCH, OW_END                       /* OW_SCRIPT_SEARCH, one pass finds one ROM */
+#endif
+};
+#if OW_CRC == 2
+const unsigned char owCrcTable[16]      = {                                     /* CRC8 of a nibble, X^8 + X^5 + X^4 + 1 reflected */
+    0x00, 0x9D, 0x23, 0xBE, 0x46, 0xDB, 0x65, 0xF8,
+    0x8C, 0x11, 0xAF, 0x32, 0xCA, 0x57, 0xE9, 0x74
+};
+#endif
+#if DS18B20_MAX_SENSORS > 1
+HAL_RAM unsigned char romTable[DS18B20_MAX_SENSORS * 6];                        /* serial numbers found by SEARCH ROM, ROM bytes 1..6,
+                                                                                 * the family and the CRC byte are not kept */
+HAL_RAM unsigned char sensorCount       = 0;
+#endif
+HAL_RAM volatile unsigned char owQueuePos = OW_SCRIPT_IDLE;                     /* the next operation in owScript[], the interrupt
+                                                                                 * puts it back to OW_SCRIPT_IDLE at OW_END */
+HAL_RAM unsigned char owArg             = 0;                                    /* sensor, configuration byte or ticks */
+HAL_RAM union {                                                                 /* one at a time, nothing is read during the search */
+    unsigned char read[3];                                                      /* TEMP LSB, TEMP MSB and CONFIG as read by OW_READ */
+    struct {
+        unsigned char pos;                                                      /* ROM bits searched, ROM bytes left to match */
+        unsigned char lastZero;
+        unsigned char lastDiscrepancy;                                          /* from one SEARCH ROM pass to the next */
+    } rom;
+#if TELEMETRY
+    struct {                                                                    /* the frame going out, in an OW_WAIT only */
+        unsigned char index;                                                    /* frame bytes sent */
+        unsigned char next;                                                     /* the high byte, taken with the low one */
+        unsigned char sum;
+    } tx;
+#endif
+} owData;
+HAL_RAM struct {                                                                /* the interrupt only, or main() with it off */
+    unsigned phase      : 4;                                                    /* OW_FETCH .. */
+    unsigned op         : 3;                                                    /* OW_END .. */
+    unsigned presence   : 1;
+} ow;
+HAL_RAM unsigned char owByte            = 0;
+HAL_RAM unsigned char owBits            = 0;
+HAL_RAM unsigned char owShift           = 0;
+HAL_RAM unsigned char owCrc             = 0;                                    /* CRC8 of the bytes read so far, 0 after a good CRC byte */
+HAL_RAM unsigned char readErrors        = 0;                                    /* scratchpad reads that failed the check, wraps */
+HAL_RAM volatile struct {                                                       /* single bits, the interrupt sets them with a BSF
+                                                                                 * while main() clears them with a BCF */
+    unsigned owAlive    : 1;                                                    /* the engine ran since the last look */
+    unsigned controlDue : 1;                                                    /* an OW_WAIT tick, or a new curve step */
+} isrFlags;
+HAL_RAM struct {                                                                /* main() only */
+    unsigned sensorLost     : 2;                                                /* samples in a row a sensor could not be read */
+    unsigned stableSamples  : 2;
+    unsigned filterReady    : 1;
+    unsigned fanStall       : 1;
+    unsigned sampleLevel    : 2;                                                /* fixed: 2304ms wait, 1:128 WDT */
+} state = { 0, 0, 0, 0, SAMPLING_ADAPTIVE ? 0 : SAMPLE_SLOWEST };
+HAL_RAM unsigned char configByte        = 0;                                    /* what the sensors hold now, 0 when unknown */
+HAL_RAM int lastReading                 = SAMPLE_NO_READING;
+HAL_RAM unsigned char tempLSB           = 0;
+HAL_RAM unsigned char tempMSB           = 0;
+HAL_RAM int tempFilter                  = 0;                                    /* Q8.4 << TEMP_EMA_SHIFT, the EMA */
+#if FAN_TACH
+HAL_ROM unsigned int fanCurveRpm[FAN_LUT_SIZE] = { FAN_LUT(FAN_RPM) };         /* target speed per degree, see fan_curve.h */
+HAL_ROM unsigned int fanDutyMin         = FAN_D10(FAN_CURVE_D0);              /* the PI not below the lowest step of the curve */
+HAL_RAM unsigned int tmr1Epoch          = 0;                                    /* Timer1 time at count 0, see tachEdge() */
+HAL_RAM volatile unsigned int tachPeriod = 0;                                   /* between the last two edges, 2us */
+HAL_RAM volatile unsigned char tachAge  = TACH_MAX_AGE;                         /* control ticks since the last edge */
+HAL_RAM int fanIntegral                 = 0;                                    /* sum of the rpm error / 32 */
+#endif
+#if TELEMETRY
+HAL_RAM unsigned char txSeq             = 0;                                    /* the rest of the frame state is in owData */
+#endif
 
-void sendBit(unsigned char BIT){
-   
-    MASTER_OUT();                                                               /* Make PIN - 3 as output */
-    MASTER_LOW();                                                               /* send low */
-    __delay_us(1);                                                              /* wait in total for 1us */
-    if(BIT){
-        RELEASE_BUS();                                                          /* release the Bus */
-        __delay_us(60);                                                         /* wait for 60us */
+/* FAN CONTROL
+ * With the tach the curve gives the speed, fanCurveRpm[], and a PI loop
+ * trims the duty around the curve duty until the fan runs at it, whatever
+ * the fan. Integer only, the gains are shifts, set for a fan that takes
+ * about 1.5s to get up to speed. The sum of the error stops while the duty
+ * is pinned at either end, so it does not wind up and overshoot.
+ * No tach edge for TACH_STALL ticks with the fan driven is a stall: 100%
+ * duty and the LED blinks until the edges come back. */
+#if FAN_TACH
+/* rpm = TACH_RPM / period, long division a bit at a time in 16 bits. The 32
+ * bit division of the C library takes more RAM than the whole loop. The top
+ * of TACH_RPM is the first remainder, below TACH_PERIOD_MIN, so the quotient
+ * fits 16 bits. It runs in fanControl() on its autos, the duty and the error
+ * are free until it is done, a function of its own would stack 8 bytes on
+ * top of them. */
+void fanControl(){
+
+    unsigned int duty;                                                          /* the rpm first, one auto less */
+    int err;                                                                    /* and the tach period */
+    unsigned int rem;
+    unsigned char bits;
+
+    HAL_PROFILE_ENTER("fanControl");
+    isrFlags.controlDue = 0;
+    if(!fanCurveRpm[pwmSelect]){
+        fanIntegral = 0;                                                        /* fan off, nothing to measure */
+        tachAge     = TACH_MAX_AGE;
+        duty        = 0;
+    } else if(tachAge >= TACH_STALL){
+        if(!state.fanStall){
+            state.fanStall = 1;
+            fanIntegral = 0;
+        }
+        if(!(tachAge & 0x7)){
+            LED_TOGGLE();                                                       /* every 8 ticks, about 2 blinks a second */
+        }
+        duty = FAN_DUTY_MAX;
     } else {
-        __delay_us(60);                                                         /* wait for 60us */
-        RELEASE_BUS();                                                          /* release the Bus */
+        if(state.fanStall){
+            state.fanStall = 0;                                                 /* turning again */
+            LED_ON();
+        }
+        DISABLE_INTERRUPTS();                                                   /* 2 bytes written by the interrupt */
+        err = tachPeriod;
+        ENABLE_INTERRUPTS();
+        duty = 0;                                                               /* no edge for 128ms, too slow to tell, take 0 */
+        if(err && tachAge < TACH_MAX_AGE){
+            rem  = (unsigned int)(TACH_RPM >> 16);
+            duty = (unsigned int)(TACH_RPM & 0xFFFF);
+            bits = 16;
+            do {
+                if(rem & 0x8000){                                               /* the remainder is 17 bits for a moment */
+                    rem  = (((rem << 1) | (duty >> 15)) - (unsigned int)err) & 0xFFFF;
+                    duty = ((duty << 1) | 1) & 0xFFFF;
+                } else {
+                    rem  = ((rem << 1) | (duty >> 15)) & 0xFFFF;                /* also where an int is wider */
+                    duty = (duty << 1) & 0xFFFF;
+                    if(rem >= (unsigned int)err){
+                        rem   = (rem - (unsigned int)err) & 0xFFFF;
+                        duty |= 1;
+                    }
+                }
+            } while(--bits);
+        }
+        err = fanCurveRpm[pwmSelect] - (int)duty;                               /* period >= TACH_PERIOD_MIN, the rpm fits an int */
+        if(err > -FAN_RPM_DEADBAND && err < FAN_RPM_DEADBAND){
+            err = 0;
+        }
+        duty = PWM_DUTY();
+        if((err > 0 && duty < (unsigned int)FAN_DUTY_MAX) || (err < 0 && duty > (unsigned int)FAN_DUTY_MIN)){
+            fanIntegral += (err + (err > 0 ? (1 << FAN_SUM_SHIFT) - 1 : 0)) >> FAN_SUM_SHIFT;  /* away from 0, an error past the
+                                                                                 * deadband counts, not while the duty is pinned, no wind up */
+        }
+        if(fanIntegral > FAN_INTEGRAL_MAX){
+            fanIntegral = FAN_INTEGRAL_MAX;
+        } else if(fanIntegral < -FAN_INTEGRAL_MAX){
+            fanIntegral = -FAN_INTEGRAL_MAX;
+        }
+        err  = (err >> FAN_KP_SHIFT) + (fanIntegral >> (FAN_KI_SHIFT - FAN_SUM_SHIFT));
+        err += (fanCurveCcpr1l[pwmSelect] << 2) | ((fanCurveCcp1con[pwmSelect] >> 4) & 0x3);  /* the curve duty, feed forward */
+        if(err < FAN_DUTY_MIN){
+            err = FAN_DUTY_MIN;
+        } else if(err > FAN_DUTY_MAX){
+            err = FAN_DUTY_MAX;
+        }
+        duty = err;                                                             /* 0..PWM_DUTY_MAX by now */
     }
-    
+    if(duty != PWM_DUTY()){
+        PWM_LOAD(duty);                                                         /* CCPR1L and CCP1CON only on a change */
+    }
+    HAL_PROFILE_EXIT("fanControl");
+
 }
+#endif
 
-void wCommand(unsigned char data){
-    
-    for(int i=0;i<8;i++){
-        sendBit(data & 0x01);                                                   /* do AND on the LSB, write command sends LSB first */
-        data = data >> 1;                                                       /* right shift one bit until reach the MSB */
+/* 1-WIRE ENGINE
+ * The bus is driven from the Timer1 interrupt, one or two interrupts per slot.
+ * main() starts a queue of byte level operations with owStart(), owQueuePos
+ * is back at OW_SCRIPT_IDLE when the queue has been worked through, no byte
+ * of its own for a done flag. The queues are the few fixed
+ * transactions in owScript[], in flash, a queue in RAM would take 8 bytes,
+ * the variable byte of each goes in owArg.
+ * Only the short parts of a slot are spent inside the interrupt (the 1us low
+ * pulse and the 9us wait before sampling a read), the 480us reset, the 60us
+ * write slots and the recovery times run on Timer1 while main() is free.
+ * Timer1 is read with TMR1_READ() in place, a function for it would put 2
+ * more bytes on the interrupt's stack. */
+void owSchedule(unsigned int us){
+
+#if FAN_TACH
+    unsigned char high;
+    unsigned char low;
+
+#endif
+    us = us / OW_TMR1_US;
+    if(!us){
+        us = 1;
     }
-    
+#if FAN_TACH
+    TMR1_READ(high, low);
+    tmr1Epoch += (((unsigned int)high << 8) | low) + us;                        /* the time goes on across the reload */
+#endif
+    us = 0 - us;                                                                /* count up to the overflow */
+    HAL_REG_WRITE(TMR1H, us >> 8);
+    HAL_REG_WRITE(TMR1L, us & 0xFF);
+    TMR1_CLEAR_FLAG_INT();
+
+}
+
+void owStart(unsigned char script, unsigned char arg){
+
+    owArg               = arg;
+    ow.presence         = 0;
+    DISABLE_INTERRUPTS();                                                       /* with Timer1 running an overflow here would */
+    ow.phase            = OW_FETCH;                                             /* start the queue before its time */
+    owQueuePos          = script;
+    TMR1_SET_FLAG_INT();                                                        /* the first operation as the interrupt is on again,
+                                                                                 * Timer1 is reloaded there, not from main() */
+    ENABLE_INTERRUPTS();
+    TMR1_ON();
+
+}
+
+void owWatchdog(){
+
+    if(isrFlags.owAlive){
+        isrFlags.owAlive = 0;
+        HAL_CLRWDT();                                                           /* once per slot or OW_WAIT tick, not if it stalls */
+    }
+
 }
 
- unsigned char readBit(){
-     
+void owWait(){
+
+    while(owQueuePos != OW_SCRIPT_IDLE){
+        owWatchdog();
+        HAL_IDLE();                                                             /* nothing else to do, the slots run in the interrupt */
+    }
+
+}
+
+/* An OW_WAIT queue, the fan control runs once per tick meanwhile, after the
+ * watchdog so it does not push the clear away from the tick. Kept apart
+ * from owWait() so the reads, deep in the compiled stack already, do not
+ * carry fanControl() on top. */
+void owWaitTicks(){
+
+    while(owQueuePos != OW_SCRIPT_IDLE){
+        owWatchdog();
+#if FAN_TACH
+        if(isrFlags.controlDue){
+            fanControl();
+        }
+#endif
+        HAL_IDLE();
+    }
+
+}
+
+unsigned char owReadSlot(){
+
     MASTER_OUT();                                                               /* Make PIN - 3 as output */
     MASTER_LOW();                                                               /* send low */
     __delay_us(1);                                                              /* wait in total for 1us */
     RELEASE_BUS();                                                              /* release the Bus */
     __delay_us(8);                                                              /* delay for 8 us */
-    tmpBit = MASTER_READ_BIT;                                                   /* MASTER samples the port */
-    __delay_us(51);                                                             /* delay for 51 us (1 us + 8 us + 51 us = 60 us TOTAL */
-    return tmpBit;
-    
+    return MASTER_READ_BIT;                                                     /* MASTER samples the port */
+
 }
 
-unsigned char readByte(){
-    
-    unsigned char tmpByte = 0;
-    for(int i=0;i<8;i++){
-        tmpByte = tmpByte >> 1;                                                 /* shift right by 1, read LSB first */
-        if(readBit() & 0x01){
-            tmpByte = tmpByte | 0x80;                                           /* do OR if if high read from the port */
+#if DS18B20_MAX_SENSORS > 1
+void owSearchStep(){
+                                                                                /* SEARCH ROM, Maxim application note 187
+                                                                                 * owShift holds the bit and its complement as read,
+                                                                                 * the direction taken is written back on the next slot.
+                                                                                 * Only a DS18B20 family code is followed, the CRC byte
+                                                                                 * of the previous ROM is what owCrc gives by then */
+    unsigned char byte  = owData.rom.pos >> 3;                                  /* ROM byte 0 family, 1..6 serial, 7 CRC */
+    unsigned char mask  = 1 << (owData.rom.pos & 0x7);
+    unsigned char dir;
+
+    owData.rom.pos++;                                                           /* bit number 1..64 */
+    switch(owShift & 0x3){
+        case 0x3:                                                               /* nobody answered, abandon the pass */
+            ow.phase = OW_FETCH;
+            return;
+        case 0x2:
+            dir = 1;                                                            /* all remaining sensors have a 1 */
+            break;
+        case 0x1:
+            dir = 0;                                                            /* all remaining sensors have a 0 */
+            break;
+        default:                                                                /* both values present */
+            if(!byte){
+                dir = (DS18B20_FAMILY & mask) ? 1 : 0;                          /* another family, never searched again */
+                break;
+            } else if(owData.rom.pos < owData.rom.lastDiscrepancy){
+                if(byte < 7){
+                    dir = (romTable[(owArg - 1) * 6 + byte - 1] & mask) ? 1 : 0;  /* same as the previous ROM */
+                } else {
+                    dir = owCrc & 0x01;
+                }
+            } else {
+                dir = (owData.rom.pos == owData.rom.lastDiscrepancy);
+            }
+            if(!dir){
+                owData.rom.lastZero = owData.rom.pos;
+            }
+            break;
+    }
+    if(!byte && dir != ((DS18B20_FAMILY & mask) ? 1 : 0)){
+        ow.phase = OW_FETCH;                                                    /* no DS18B20 down this branch, abandon the pass */
+        return;
+    }
+    if(dir && byte && byte < 7){
+        romTable[owArg * 6 + byte - 1] |= mask;
+    }
+    OW_CRC_BIT(dir);                                                            /* the ROM CRC8 runs along, 0 at the end */
+    owByte   = dir;
+    owBits   = 1;
+    ow.phase = OW_WRITE_SLOT;
+
+}
+#endif
+
+void owService(){
+
+    HAL_PROFILE_ENTER("owService");
+    switch(ow.phase){
+        case OW_FETCH:
+            ow.op = owScript[owQueuePos++];
+            if(ow.op == OW_RESET){
+                MASTER_OUT();                                                   /* Make PIN - 3 as output */
+                MASTER_LOW();                                                   /* Send LOW for 480 us */
+                ow.phase = OW_PRESENCE;
+                owSchedule(480);
+            } else if(ow.op == OW_WRITE || ow.op == OW_READ || ow.op == OW_WRITE_3){
+                owByte   = (ow.op == OW_WRITE_3) ? owArg : owScript[owQueuePos++];
+                owBits   = (ow.op == OW_WRITE_3) ? 24 : 8;
+                owCrc    = 0;
+                ow.phase = (ow.op == OW_READ) ? OW_READ_SLOT : OW_WRITE_SLOT;
+                owSchedule(2);
+            } else if(ow.op == OW_MATCH){
+                owByte      = DS18B20_SKIP;                                     /* only one (or none found), SKIP is 8 bytes shorter */
+#if DS18B20_MAX_SENSORS > 1
+                owData.rom.pos = 0;
+                if(sensorCount > 1){
+                    owData.rom.pos = 8;                                         /* 8 ROM bytes follow the command */
+                    owByte         = DS18B20_MATCH;
+                }
+#endif
+                owBits      = 8;
+                ow.phase    = OW_WRITE_SLOT;
+                owSchedule(2);
+#if DS18B20_MAX_SENSORS > 1
+            } else if(ow.op == OW_SEARCH){
+                owData.rom.pos      = 0;
+                owData.rom.lastZero = 0;
+                owCrc               = 0;
+                ow.phase            = OW_SEARCH_ID;
+                owSchedule(2);
+#endif
+            } else if(ow.op == OW_WAIT){
+                owByte   = owArg;                                               /* never 0 */
+                ow.phase = OW_WAIT_TICK;
+                owSchedule(OW_TICK_US);
+            } else {
+#if !FAN_TACH
+                TMR1_OFF();                                                     /* queue finished, with the tach Timer1 keeps the time */
+#endif
+                owQueuePos = OW_SCRIPT_IDLE;
+            }
+            break;
+        case OW_PRESENCE:
+            RELEASE_BUS();                                                      /* DS18B20 answers 15-60 us later for 60-240 us */
+            ow.phase = OW_PRESENCE_SAMPLE;
+            owSchedule(60);                                                     /* low for every sensor at 60-75 us, the interrupt
+                                                                                 * takes 4-12 us more, sampled at 64-72 us */
+            break;
+        case OW_PRESENCE_SAMPLE:
+            ow.presence = !MASTER_READ_BIT;                                     /* low means a sensor is there */
+            ow.phase = OW_PRESENCE_END;
+            owSchedule(420);                                                    /* rest of the 480 us presence window */
+            break;
+        case OW_PRESENCE_END:
+            if(!MASTER_READ_BIT){
+                ow.presence = 0;                                                /* still low, a shorted bus and not a sensor */
+            }
+            if(!ow.presence){
+                while((ow.op = owScript[owQueuePos]) != OW_END){
+                    owQueuePos += (ow.op == OW_WRITE || ow.op == OW_READ) ? 2 : 1;  /* nobody there, drop the rest of the queue */
+                }
+            }
+            ow.phase = OW_FETCH;
+            owSchedule(2);
+            break;
+        case OW_WRITE_SLOT:
+            MASTER_OUT();                                                       /* Make PIN - 3 as output */
+            MASTER_LOW();                                                       /* send low */
+            __delay_us(1);
+            if(owByte & 0x01){
+                RELEASE_BUS();                                                  /* a 1 is released straight away */
+            }
+#if DS18B20_MAX_SENSORS > 1
+            if(ow.op == OW_MATCH){
+                OW_CRC_BIT(owByte);                                             /* of the ROM going out, for its CRC byte */
+            }
+#endif
+            owByte   = owByte >> 1;                                             /* LSB first */
+            ow.phase = OW_WRITE_RELEASE;
+            owSchedule(60);
+            break;
+        case OW_WRITE_RELEASE:
+            RELEASE_BUS();                                                      /* end of a 0, no effect on a 1 */
+            ow.phase = OW_FETCH;
+            if(--owBits){
+                if(!(owBits & 0x7)){
+                    owByte = owArg;                                             /* OW_WRITE_3, the same byte again */
+                }
+                ow.phase = OW_WRITE_SLOT;
+#if DS18B20_MAX_SENSORS > 1
+            } else if(ow.op == OW_MATCH && owData.rom.pos){
+                if(owData.rom.pos == 8){
+                    owByte = DS18B20_FAMILY;                                    /* the ROM, LSB first */
+                    owCrc  = 0;
+                } else if(owData.rom.pos > 1){
+                    owByte = romTable[owArg * 6 + 7 - owData.rom.pos];          /* the serial number */
+                } else {
+                    owByte = owCrc;                                             /* the CRC8 of the 7 bytes as they went out */
+                }
+                owData.rom.pos--;
+                owBits   = 8;
+                ow.phase = OW_WRITE_SLOT;
+            } else if(ow.op == OW_SEARCH){
+                if(owData.rom.pos < 64){
+                    ow.phase = OW_SEARCH_ID;
+                } else {
+                    owData.rom.lastDiscrepancy = owData.rom.lastZero;           /* where the next pass takes the 1 branch */
+                }
+#endif
+            }
+            owSchedule(2);                                                      /* recovery between slots */
+            break;
+#if DS18B20_MAX_SENSORS > 1
+        case OW_SEARCH_ID:
+            owShift  = owReadSlot();                                            /* the ROM bit of every sensor still in the pass */
+            ow.phase = OW_SEARCH_CMP;
+            owSchedule(52);
+            break;
+        case OW_SEARCH_CMP:
+            owShift = (owShift << 1) | owReadSlot();                            /* and its complement */
+            owSearchStep();
+            owSchedule(52);
+            break;
+#endif
+        case OW_READ_SLOT:
+            owShift = owShift >> 1;                                             /* shift right by 1, read LSB first */
+            if(owReadSlot()){
+                owShift = owShift | 0x80;
+            }
+#if OW_CRC == 1
+            OW_CRC_BIT(owShift >> 7);
+            HAL_CYCLES(OW_CRC_BIT_CYCLES);
+#endif
+            if(--owBits == 0){
+                owBits = owScript[owQueuePos - 1] - owByte;                     /* the byte number, owBits is free until the next */
+                if(owBits < OW_DATA_CONFIG){
+                    owData.read[owBits] = owShift;                              /* TEMP LSB, TEMP MSB */
+                } else if(owBits == 4){
+                    owData.read[OW_DATA_CONFIG] = owShift;
+                }
+#if OW_CRC == 2
+                owCrc = (owCrc >> 4) ^ owCrcTable[(owCrc ^ owShift) & 0x0F];   /* low nibble first */
+                owCrc = (owCrc >> 4) ^ owCrcTable[(owCrc ^ (owShift >> 4)) & 0x0F];
+                HAL_CYCLES(OW_CRC_BYTE_CYCLES);
+#endif
+                owBits = 8;
+                if(--owByte == 0){
+                    ow.phase = OW_FETCH;
+                }
+            }
+            owSchedule(52);                                                     /* 1 us + 8 us + 52 us, slot plus recovery */
+            break;
+        case OW_WAIT_TICK:
+#if FAN_TACH
+            isrFlags.controlDue = 1;
+            if(++tachAge == 0){
+                tachAge = TACH_STALL;                                           /* stays stalled, keeps blinking */
+            }
+#endif
+            if(--owByte){
+                owSchedule(OW_TICK_US);                                         /* one interrupt per tick, main() idles meanwhile */
+            } else {
+                ow.phase = OW_FETCH;
+                owSchedule(2);
+            }
+            break;
+    }
+    HAL_PROFILE_EXIT("owService");
+
+}
+
+/* TACH
+ * Timer1 is reloaded for every slot, so it can not be read as a clock by
+ * itself. tmr1Epoch is moved on by what the count had reached plus the new
+ * wait at each reload, tmr1Epoch + TMR1 then keeps counting 2us steps mod
+ * 65536 whatever the 1-wire engine does, and Timer1 never stops with the
+ * tach. Each timed edge moves tmr1Epoch back to 0 at that edge, so the
+ * count is the time since the last one. Only falling edges of GP1 are
+ * timed, one per half turn. */
+#if FAN_TACH
+void tachEdge(){
+
+    unsigned char high;
+    unsigned int period;
+
+    if(TACH_READ_BIT){
+        return;                                                                 /* rising edge */
+    }
+    TMR1_READ(high, period);                                                    /* TMR1L into the low byte */
+    period = (tmr1Epoch + (((unsigned int)high << 8) | period)) & 0xFFFF;       /* mod 65536, also where an int is wider */
+    if(tachAge >= TACH_MAX_AGE){
+        tachPeriod = 0;                                                         /* the first edge, or after a long gap */
+    } else if(period < TACH_PERIOD_MIN){
+        return;                                                                 /* a glitch, keep the last edge */
+    } else {
+        tachPeriod = period;
+    }
+    tmr1Epoch  -= period;                                                       /* 0 at this edge */
+    tachAge     = 0;
+
+}
+#endif
+
+/* TELEMETRY
+ * A frame per sample, see telemetry.h, goes out of GP0 at 9600 8N1, one bit
+ * per Timer0 interrupt. Timer0 runs at 1:1 (the prescaler is the watchdog's),
+ * 208 cycles a bit are TMR0 moved on by the rest of 256 in each interrupt, so
+ * the latency of one bit does not shift the next. There is no RAM for a copy
+ * of the frame: main() only starts it, the interrupt takes each byte from
+ * the variables at its start bit, the high byte of a 16 bit value with the
+ * low one into tx.next so the two match, and sums what it sent. The frame is
+ * started after the sample and goes out in the OW_WAIT that follows, so no
+ * bit interrupt lands in a 1-wire slot. Timer0 stops in SLEEP, the frame is
+ * finished first, 11.5ms at the most.
+ * An OW_WAIT does not touch owData, owShift and owBits, the frame goes out
+ * of them: the byte from owShift, the bit times left of it in owBits. The
+ * frame is over before the wait is, a wait is 144ms at the least,
+ * telemetryDrain() makes sure before the next transaction. Only txSeq has
+ * a byte of its own. */
+#if TELEMETRY
+void txService(){
+
+    HAL_PROFILE_ENTER("txService");
+    HAL_REG_WRITE(TMR0, HAL_REG_READ(TMR0) + TX_TMR0_ADD);                      /* ADDWF, from the last overflow not from now */
+    TMR0_CLEAR_FLAG_INT();
+    if(owBits > 1){
+        HAL_BIT_WRITE(GPIO, GP0, owShift & 0x01);                               /* data, LSB first */
+        owShift = owShift >> 1;
+        owBits--;
+    } else if(owBits){
+        TX_HIGH();                                                              /* stop bit */
+        owBits = 0;
+    } else if(owData.tx.index < TELEMETRY_FRAME){
+        TX_LOW();                                                               /* start bit, the byte is needed a bit time later */
+        switch(owData.tx.index){
+        case 0:
+            owShift = TELEMETRY_SYNC;
+            break;
+        case TELEMETRY_SEQ:
+            owShift = txSeq;
+            break;
+        case TELEMETRY_TEMP:
+            owShift = tempLSB;
+            owData.tx.next = tempMSB;
+            break;
+        case TELEMETRY_DUTY:
+            owShift = (HAL_REG_READ(CCPR1L) << 2) | ((HAL_REG_READ(CCP1CON) >> 4) & 0x3);  /* CCPR1L:DC1B as it runs */
+            owData.tx.next = (HAL_REG_READ(CCPR1L) >> 6) | (state.sampleLevel << TELEMETRY_LEVEL_SHIFT);
+            if(state.sensorLost >= DS18B20_LOST_SAMPLES){
+                owData.tx.next |= TELEMETRY_LOST;
+            }
+#if FAN_TACH
+            owData.tx.next |= TELEMETRY_HAS_TACH;
+            if(state.fanStall){
+                owData.tx.next |= TELEMETRY_STALL;
+            }
+#endif
+            break;
+        case TELEMETRY_TACH:
+            owShift = 0;
+            owData.tx.next = 0;
+#if FAN_TACH
+            if(tachAge < TACH_MAX_AGE){
+                owShift = tachPeriod & 0xFF;                                    /* the tach interrupt is not running now */
+                owData.tx.next = tachPeriod >> 8;
+            }
+#endif
+            break;
+        case TELEMETRY_ERRORS:
+            owShift = readErrors;
+            break;
+        case TELEMETRY_STEP:
+            owShift = pwmSelect;
+            break;
+        case TELEMETRY_SUM:
+            owShift = owData.tx.sum;                                            /* the sum of all 11 comes to 0 */
+            break;
+        default:
+            owShift = owData.tx.next;                                           /* the MSB of the one before */
+            break;
         }
+        owData.tx.sum -= owShift;
+        owData.tx.index++;
+        owBits = 9;
+        HAL_CYCLES(TX_BYTE_CYCLES);
+    } else {
+        DISABLE_TMR0_INT();                                                     /* frame sent, the line stays high */
     }
-    return tmpByte;
-    
+    HAL_CYCLES(TX_SERVICE_CYCLES);
+    HAL_PROFILE_EXIT("txService");
+
 }
 
+void telemetrySend(){
+
+    HAL_PROFILE_ENTER("telemetrySend");
+    txSeq++;
+    if(HAL_BIT_READ(INTCON, T0IE)){
+        HAL_PROFILE_EXIT("telemetrySend");
+        return;                                                                 /* the last one is still going, a gap in txSeq */
+    }
+    owBits          = 0;                                                        /* the interrupt does not touch them until T0IE */
+    owData.tx.index = 0;
+    owData.tx.sum   = 0;
+    HAL_REG_WRITE(TMR0, 256 - TELEMETRY_BIT_CYCLES);                            /* the start bit one bit time from now */
+    TMR0_CLEAR_FLAG_INT();
+    ENABLE_TMR0_INT();
+    HAL_PROFILE_EXIT("telemetrySend");
+
+}
+
+void telemetryDrain(){
+
+    while(HAL_BIT_READ(INTCON, T0IE)){
+        HAL_IDLE();                                                             /* Timer0 stops in SLEEP */
+    }
+
+}
+#endif
+
+HAL_ISR(isr){
+
+    HAL_PROFILE_ENTER("isr");
+#if TELEMETRY
+    if(HAL_BIT_READ(INTCON, T0IE) && HAL_BIT_READ(INTCON, T0IF)){
+        txService();                                                            /* first, an edge late by a part of a bit is fine */
+    }
+#endif
+    if(HAL_BIT_READ(PIR1, TMR1IF)){
+        TMR1_CLEAR_FLAG_INT();
+        if(owQueuePos != OW_SCRIPT_IDLE){
+            owService();                                                        /* Timer1 runs on between queues with the tach */
+            isrFlags.owAlive = 1;
+        }
+    }
+#if FAN_TACH
+    if(HAL_BIT_READ(INTCON, GPIF)){
+        tachEdge();                                                             /* reading GPIO ends the mismatch */
+        GPIF_INT_INTERRUPT_FLAG_CLEAR();
+    }
+#endif
+    HAL_PROFILE_EXIT("isr");
+
+}
+
+/* DS18B20 FUNCTIONS
+ * A SEARCH ROM pass whose ROM fails its CRC8, bit noise on the bus, is run
+ * again down the same branch, up to DS18B20_READ_TRIES times, a bad ROM is
+ * never taken into romTable. The ROM CRC8 covers the family code and the
+ * serial number, MATCH ROM sends the CRC byte from them again. */
+#if DS18B20_MAX_SENSORS > 1
+void searchSensors(){
+
+    unsigned char tries = DS18B20_READ_TRIES;
+    unsigned char last;
+
+    owData.rom.lastDiscrepancy = 0;
+    sensorCount = 0;
+    while(sensorCount < DS18B20_MAX_SENSORS){
+        for(unsigned char i=0;i<6;i++){
+            romTable[sensorCount * 6 + i] = 0;
+        }
+        last = owData.rom.lastDiscrepancy;
+        owStart(OW_SCRIPT_SEARCH, sensorCount);                                 /* one pass finds one ROM */
+        owWait();
+        if(!ow.presence || owData.rom.pos != 64){
+            break;                                                              /* nobody on the bus */
+        }
+        if(owCrc){
+            readErrors++;
+            owData.rom.lastDiscrepancy = last;                                  /* the same branch again */
+            if(--tries){
+                continue;
+            }
+            break;
+        }
+        tries = DS18B20_READ_TRIES;
+        sensorCount++;
+        if(!owData.rom.lastDiscrepancy){
+            break;                                                              /* no discrepancy left, that was the last one */
+        }
+    }
+
+}
+#endif
+
 void resolutionCheck(unsigned char res){
     
-    if(( res | 0x60 ) == 0x7F ) {                                               /* If resolution is 12 bit change it to 9 bit */
-        sendReset();                                                            /* Send Reset plus the Presence to start communicating with DS18B20 */
-        wCommand(DS18B20_SKIP);                                                 /* Send the SKIP command we are addressing only one sensor */
-        wCommand(DS18B20_WRITE_SCRATCHPAD);                                     /* Write the 3 bytes of scratchpad TH,TL,CONF */
-        for(int i=0;i<3;i++){
-            wCommand(DS18B20_9BIT_RESOLUTION);                                  /* send the configuration byte of 9 bit resolution 00011111 
-                                                                                 * on all bytes even TH,TL (ignore, not in use) */
-        }
-        sendReset();                                                            /* Send Reset plus the Presence to start communicating with DS18B20 */
-        wCommand(DS18B20_SKIP);                                                 /* Send the SKIP command we are addressing only one sensor */
-        wCommand(DS18B20_COPY);                                                 /* Send the COPY command to write the contents of byte 2,3,4 on EEPROM */
-                                                                                /* Now DS18B20 is set on 9 bit resolution */
-        DS18B20_BUSY();                                                         /* check if BUS is busy (low) */ 
+    HAL_PROFILE_ENTER("resolutionCheck");
+    if(res != configByte){                                                      /* only when the resolution changes */
+        owStart(OW_SCRIPT_CONFIG, res);                                         /* SKIP, every sensor on the bus gets the same setting,
+                                                                                 * the configuration byte 0 R1 R0 11111 on all 3 bytes
+                                                                                 * of the scratchpad even TH,TL (ignore, not in use),
+                                                                                 * no COPY SCRATCHPAD, the EEPROM is not worn by the
+                                                                                 * changes and every boot sets the resolution again */
+        owWait();
+        configByte = ow.presence ? res : 0;                                     /* nobody there, write it again next time */
     }
+    HAL_PROFILE_EXIT("resolutionCheck");
     
 }
 
+void startConversion(){
+
+    HAL_PROFILE_ENTER("startConversion");
+    owStart(OW_SCRIPT_CONVERT, 0);                                              /* SKIP addresses all sensors at once, they all
+                                                                                 * convert in parallel, one wait for N sensors */
+    HAL_PROFILE_EXIT("startConversion");
+
+}
+
+/* SCRATCHPAD
+ * All 9 bytes are read and the CRC8 runs along in the read slots, so it is 0
+ * once the CRC byte is in. A read counts only with a presence pulse, a good
+ * CRC and the fixed 1 bits of the configuration byte, which an all 0 bus
+ * would pass the CRC without. A bad read is repeated up to
+ * DS18B20_READ_TRIES times, after that the caller keeps what it had.
+ * Without OW_CRC only the first 5 bytes are read, the temperature to the
+ * configuration byte, and the presence pulse is all there is to check. */
+unsigned char readScratchpad(unsigned char sensor){
+
+    unsigned char tries = DS18B20_READ_TRIES;
+
+    HAL_PROFILE_ENTER("readScratchpad");
+    do {
+        owStart(OW_SCRIPT_READ, sensor);
+        owWait();
+#if OW_CRC
+        if(ow.presence && owCrc == 0 && (owData.read[OW_DATA_CONFIG] & 0x9F) == 0x1F){
+#else
+        if(ow.presence){
+#endif
+            HAL_PROFILE_EXIT("readScratchpad");
+            return 1;
+        }
+        readErrors++;
+    } while(--tries);
+    HAL_PROFILE_EXIT("readScratchpad");
+    return 0;
+
+}
+
+/* A sensor that can not be read is left out of the hottest, with none read
+ * the fan stays where it is. No sensor found by the search is none read,
+ * the fail-safe, and the bus is searched again every sample until one
+ * answers. */
+void readTemperatures(){
+
+    unsigned char sensor = 0;
+    unsigned char read = 0;                                                     /* sensors read so far */
+
+    HAL_PROFILE_ENTER("readTemperatures");
+#if DS18B20_MAX_SENSORS > 1
+    if(!sensorCount){
+        searchSensors();                                                        /* plugged in since, it converted with the SKIP */
+    }
+#endif
+    do {
+        if(readScratchpad(sensor)){                                             /* the temperature is byte0, byte1 */
+            if(!read++ || (signed char)owData.read[1] > (signed char)tempMSB
+               || (owData.read[1] == tempMSB && owData.read[0] > tempLSB)){
+                tempLSB = owData.read[0];                                       /* the fan follows the hottest sensor */
+                tempMSB = owData.read[1];
+            }
+#if OW_CRC
+            if(owData.read[OW_DATA_CONFIG] != configByte){
+                configByte = 0;                                                 /* powered up again or replaced, write it again */
+            }
+#endif
+        }
+    } while(++sensor < SENSOR_COUNT);
+    if(read && read == SENSOR_COUNT){
+        if(state.sensorLost){
+            LED_ON();                                                           /* back from the fail-safe */
+        }
+        state.sensorLost = 0;
+    } else if(state.sensorLost < DS18B20_LOST_SAMPLES){
+        state.sensorLost++;
+    }
+    HAL_PROFILE_EXIT("readTemperatures");
+
+}
 
 void SYSTEM_Initialize(){
     
                                                                                 /* CONFIGURATION OF GPIO PINS
+                                                                                 * GP0 - TELEMETRY TX   - PIN 7
+                                                                                 * GP1 - FAN TACH INPUT - PIN 6
                                                                                  * GP2 - PWM OUTPUT P1A - PIN 5
                                                                                  * GP4 - DS18B20        - PIN 3
                                                                                  * GP5 - OUTPUT LED     - PIN 2 
@@ -205,24 +1056,33 @@ void SYSTEM_Initialize(){
 
     ENABLE_DIGITAL_IO_PINS();                                                   /* disable analog enable digital pins */
     SET_PORTA();                                                                /* 00001100 GP0,GP1,GP4,GP5 as OUTPUT, GP2,GP3 as INPUT
+                                                                                   00001110 with the tach, GP1 as INPUT too
                                                                                    initially you need to disable output for PWM on GP2
                                                                                    as per documentation  */
+#if TELEMETRY
+    TX_HIGH();                                                                  /* GP0 telemetry, the line idles high */
+#else
     SET_GPIO0_LOW();                                                            /* make GP0 output low */
+#endif
     SET_GPIO1_LOW();                                                            /* make GP1 output low */
     SET_GPIO4_LOW();                                                            /* make GP4 output low */
     SET_GPIO5_LOW();                                                            /* make GP5 output low */
 
-    SET_OPTION_REG();                                                           /* 10000000, 0x80
-                                                                                 * GPIO pull-ups disable 1,
+    SET_WPU();
+    SET_OPTION_REG();                                                           /* 10001111, 0x8F, 0x0F with the tach
+                                                                                 * GPIO pull-ups disable 1, 0 with the tach
                                                                                  * INTEDG on rising      0,
                                                                                  * TOSC FOSC/4 TOSE      0,
-                                                                                 * PSA                   0,
-                                                                                 * PS                    000 1:2 */
-    SET_INTCON();                                                               /* 11001000  0xC8
+                                                                                 * PSA to the WDT        1,
+                                                                                 * PS                    111 1:128, 18ms * 128 = 2.3s
+                                                                                 *                       until the end of initialisation */
+    SET_INTCON();                                                               /* 11001000  0xC8, 0xC0 without the tach
                                                                                  * GIE  1 Global Interrupt Enable bit
                                                                                  * PEIE 1 Enables all unmasked interrupts
                                                                                  * TOIE 0 Timer0 Overflow Interrupt Enable bit
-                                                                                 * INTE 1 GP2/INT External Interrupt Enable bit
+                                                                                 * INTE 0 GP2/INT External Interrupt Enable bit, GP2 is
+                                                                                 *        the PWM, INTF is set every period, the isr
+                                                                                 *        never clears it
                                                                                  * GPIE 1 GPIO Change Interrupt Enable bit, IOC must EN
                                                                                  * TOIF 0 Timer0 Overflow Interrupt Flag bit(2)
                                                                                  * INTF 0 GP2/INT External Interrupt Flag bit
@@ -230,7 +1090,7 @@ void SYSTEM_Initialize(){
     LED_ON();                                                                   /* Led ON */
     DISABLE_CCP1_OUTPUT_DRIVE();
     SET_PR2();                                                                  /* for 25khz Load value 0x4F, Load value 199 decimal for PWM freq 10KHz 0xC7  */
-    SET_CCP1CON();                                                              /* 00001100 load duty cycle 15% DC1B<1:0> set to 0 */
+    SET_CCP1CON();                                                              /* 00xx1100 PWM mode, DC1B<1:0> of the first step of the curve */
     SET_CCPR1L();                                                               /* for 25khz 15% 0xC, for 10khz 00011110 load value on CCPR1L for DC 15% 0x1E   */
     SET_PIR1();                                                                 /* Clear interrupt flag TMR2IF, TMR2 to PR2 Match
                                                                                  * Interrupt Flag bit(1) */
@@ -242,10 +1102,20 @@ void SYSTEM_Initialize(){
     ENABLE_CCP1_OUTPUT_DRIVE();                                                 /* Enable the CCP1 pin output driver by clearing
                                                                                  * GP2 P1A bit and make it as output */
    
+    SET_T1CON();                                                                /* Timer1 1:4 on FOSC/4, off until the 1-wire engine starts */
+    TMR1_CLEAR_FLAG_INT();
+    ENABLE_TMR1_INT();                                                          /* the 1-wire slots run in the Timer1 interrupt */
+    SET_IOC();                                                                  /* the tach edges in the GPIO change interrupt */
+
     /* INITIALISE DS18B20 */
-    sendReset();                                                                /* Send Reset plus the Presence to start communicating with DS18B20 */
-    wCommand(DS18B20_SKIP);                                                     /* Send the SKIP command we are addressing only one sensor */
-    wCommand(DS18B20_READ_SCRATCHPAD);                                          /* start reading the first 5 bytes from scratchpad */
+#if DS18B20_MAX_SENSORS > 1
+    searchSensors();                                                            /* find the ROM code of every sensor on GP4 */
+#endif
+    for(unsigned char sensor=0;sensor==0 || sensor<SENSOR_COUNT;sensor++){
+        if(!readScratchpad(sensor)){                                            /* the first 5 bytes from scratchpad */
+            configByte = 0;                                                     /* unknown, all of them get rewritten */
+            continue;
+        }
                                                                                 /* the first two are the temperature (ignore) */
                                                                                 /* the next 2 bytes are the alarm/user bytes TH and TL (ignore)
                                                                                  * the next 1 byte is the configuration of DS18B20 
@@ -256,71 +1126,247 @@ void SYSTEM_Initialize(){
                                                                                  * configuration byte= 0 R1 R0 11111
                                                                                  *                   MSB           LSB
                                                                                  * Set R1=0 and R0=0 sets the resolution to 9 bits */
-    for(int i=0;i<5;i++){    
-        configByte = readByte();                                                /* the first 4 bytes are overwritten (ignored) */                            
+        if(sensor == 0){
+            configByte = owData.read[OW_DATA_CONFIG];
+        } else if(owData.read[OW_DATA_CONFIG] != configByte){
+            configByte = 0;                                                     /* they differ, all of them get rewritten */
+        }
     }
-    sendReset();                                                                /* Send a RESET to stop reading after the 5th byte */
-    resolutionCheck(configByte);
+    resolutionCheck(DS18B20_CONFIG(SAMPLING_ADAPTIVE ? state.sampleLevel : 0));
+    HAL_CLRWDT();
+    SET_WDT_PRESCALER(WDT_AWAKE_PRESCALER);                                     /* from here a stall resets within 72ms */
     
 }
 
 /* PWM */
 void selectPwmDutyCycle(unsigned char pos){
     
-    CCPR1L = pwmDutyCycle[pos];                                                 /* Since using a 25 Khz PWM frequency the register  
-                                                                                   CCP1CON = 0xC remains with the same value (0000 1100) where the two bits are always 00 
-                                                                                   bit 5-4 DC1B<1:0>: PWM Duty Cycle Least Significant bits 
-                                                                                   only the CCPR1L changes between different duty cycles.
-                                                                                   According to the documentation the duty cycle registers can be changed at any time */
-    CCP1CON = 0xC;                                                              /* bit 5-4 DC1B<1:0> do not change stay 00 */
+    HAL_REG_WRITE(CCPR1L, fanCurveCcpr1l[pos]);                                 /* duty cycle bits 9-2 */
+    HAL_REG_WRITE(CCP1CON, fanCurveCcp1con[pos]);                               /* bit 5-4 DC1B<1:0> duty cycle bits 1-0, PWM mode 1100
+                                                                                   According to the documentation the duty cycle registers can be changed at any time,
+                                                                                   the new value is taken at the start of the next PWM period */
     
 }
                                                                 
-void plusOrMinus(unsigned char MSB, unsigned char LSB){
-    
-    if((MSB & 0x80) == 0x80 ){
-        posNegTemp = 1;                                                         /* Temperature is above zero + */
-    } else {
-        posNegTemp = 0;                                                         /* Temperature is below zero - */
-    }    
-    /* the below line is not needed*/
-    //if((LSB & 0x8)  == (0x8))   halfTemp   = 1;                               /* Temperature reading .5 value */
-    
+/* The scratchpad temperature is already Q8.4, 1/16 C in a signed int, the
+ * fraction is kept all the way. The EMA is shifts and adds only:
+ *     acc += (sample * 2^K - acc) / 2^k,  temp = acc / 2^K
+ * with K = TEMP_EMA_SHIFT and k = K less one per sample level, so the weight
+ * doubles each time the sample period does and the filter takes about the
+ * same time, 1s, at every rate. The slow 12 bit samples are not filtered.
+ * The EMA only ever closes in on a sample, it would take seconds to cover
+ * the last fraction of a step, so within one sensor step it takes the
+ * sample as it is, a reading right on a band edge is in the band at once.
+ * With hysteresis a band is entered as soon as the filtered temperature
+ * reaches it but left downwards only FAN_HYSTERESIS below its lower edge,
+ * so a reading sitting on a band edge does not toggle the fan. */
+unsigned char fanBand(int temp){
+
+    temp = temp >> 4;                                                           /* whole degrees, rounded down */
+    if (temp <= FAN_LUT_BASE) {
+        return 0;                                                               /* below the curve, fan off */
+    } else if (temp >= FAN_LUT_BASE + FAN_LUT_SIZE - 1) {
+        return FAN_LUT_SIZE - 1;                                                /* past the end of the curve, last entry */
+    }
+    return (unsigned char)(temp - FAN_LUT_BASE);                                /* one entry per degree */
+
 }
 
-void temperatureCompare(unsigned char MSB, unsigned char LSB){
-
-    convertedTemp = ((MSB & 0x7) << 4) | (LSB >> 4);                            /* Combine the two bytes into one to get the temperature */
-    if (convertedTemp < 0x1E || posNegTemp == 0) {
-        selectPwmDutyCycle(0);                                                  /* Stop PWM by sending 0 for duty cycle, temperature is lower than 30 Celsius */ 
-    } 
-    if (convertedTemp >= 0x1E && convertedTemp < 0x23 )selectPwmDutyCycle(1);   /* 30 - 35 duty cycle  15% */
-    if (convertedTemp >= 0x23 && convertedTemp < 0x28 )selectPwmDutyCycle(2);   /* 35 - 40 duty cycle  30% */
-    if (convertedTemp >= 0x28 && convertedTemp < 0x2D )selectPwmDutyCycle(3);   /* 40 - 45 duty cycle  45% */
-    if (convertedTemp >= 0x2D && convertedTemp < 0x32 )selectPwmDutyCycle(4);   /* 45 - 50 duty cycle  60% */
-    if (convertedTemp >= 0x32 && convertedTemp < 0x37 )selectPwmDutyCycle(5);   /* 50 - 55 duty cycle  75% */
-    if (convertedTemp >= 0x37 && convertedTemp < 0x3C )selectPwmDutyCycle(6);   /* 55 - 60 duty cycle  90% */
-    if (convertedTemp >= 0x3C) selectPwmDutyCycle(7);                           /* 60 -    duty cycle 100% */
+void temperatureCompare(){
+
+    int temp = ((int)(signed char)tempMSB * 256 + tempLSB) << TEMP_EMA_SHIFT;  /* the sample, Q8.4 << K */
+    unsigned char band;
+    unsigned char k = TEMP_EMA_SHIFT;
+
+    HAL_PROFILE_ENTER("temperatureCompare");
+    if(!state.filterReady){
+        tempFilter = temp;                                                      /* start from the first reading, not from 0 */
+        state.filterReady = 1;
+    }
+    k = (state.sampleLevel < k) ? k - state.sampleLevel : 0;
+    temp -= tempFilter;                                                         /* the sample from the EMA, tempFilter + temp is it */
+    if(temp >= (TEMP_EMA_BYPASS << TEMP_EMA_SHIFT) || temp <= -(TEMP_EMA_BYPASS << TEMP_EMA_SHIFT)){
+        tempFilter += temp;                                                     /* a real move, follow it straight away */
+    } else if(temp < TEMP_SENSOR_LSB(state.sampleLevel) && temp > -TEMP_SENSOR_LSB(state.sampleLevel)){
+        tempFilter += temp;                                                     /* closer than the sensor can tell, it is there */
+    } else if(temp > 0){
+        tempFilter += (temp + (1 << k) - 1) >> k;                               /* rounded towards the sample, so it gets there */
+    } else {
+        tempFilter += temp >> k;                                                /* >> rounds negatives down, towards the sample */
+    }
+    temp = tempFilter >> TEMP_EMA_SHIFT;
+    band = fanBand(temp);
+    if(band < pwmSelect){
+        band = fanBand(temp + FAN_HYSTERESIS);                                  /* down only once clear of the edge */
+        if(band > pwmSelect){
+            band = pwmSelect;
+        }
+    }
+    if(band != pwmSelect){
+        pwmSelect = band;
+#if FAN_TACH
+        isrFlags.controlDue = 1;                                                /* new target, fanControl() sets the duty */
+#else
+        selectPwmDutyCycle(pwmSelect);                                          /* CCPR1L and CCP1CON only when the band changes */
+#endif
+    }
+    HAL_PROFILE_EXIT("temperatureCompare");
  
 }
 
+/* SCHEDULING
+ * SLEEP stops the 8Mhz oscillator and with it Timer1, Timer2 and the PWM, only
+ * the watchdog keeps running and wakes the core. So the core sleeps between
+ * samples only while the fan output is a steady level, off or at 100%, with
+ * CCP1 switched off and GP2 holding that level as a plain output.
+ * Any other duty needs Timer2, then the wait runs on Timer1 ticks instead
+ * and main() idles between the tick interrupts. */
+unsigned char pwmIsStatic(){
+
+#if FAN_TACH
+    return PWM_DUTY() == 0 && fanCurveRpm[pwmSelect] == 0;                       /* at 100% the tach still has to be watched */
+#else
+    if(fanCurveCcpr1l[pwmSelect] > PWM_PR2){
+        return 1;                                                               /* duty >= period, GP2 is always high */
+    }
+    return fanCurveCcpr1l[pwmSelect] == 0 && (fanCurveCcp1con[pwmSelect] & 0x30) == 0;  /* 0%, always low */
+#endif
+
+}
+
+/* SAMPLE RATE
+ * dT/dt is the change since the last reading scaled to the slowest sample
+ * period, so the thresholds mean the same at every level. A fast change goes
+ * straight to level 0, 9 bits and 144ms between samples, a few stable samples
+ * in a row step one level slower, up to 12 bits and 1.15s. The slowest level
+ * samples about as often as the fixed 2.3s did, the fastest 10 times as often. The reading after a change of
+ * level is not compared, the resolution changed and so did its rounding. */
+void adaptSampling(){
+
+#if SAMPLING_ADAPTIVE
+    int reading = (int)(signed char)tempMSB * 256 + tempLSB;                   /* signed 1/16 C, the hottest sensor */
+    int rate;
+    unsigned char level = state.sampleLevel;
+
+    if(state.sensorLost){
+        state.sampleLevel = 0;                                                  /* a sensor did not answer, look again soon */
+        state.stableSamples = 0;
+    } else if(lastReading != SAMPLE_NO_READING){
+        rate = reading - lastReading;
+        if(rate < 0){
+            rate = -rate;
+        }
+        rate = rate << (SAMPLE_SLOWEST - state.sampleLevel);
+        if(rate >= SAMPLE_FAST_RATE){
+            state.sampleLevel = 0;                                              /* moving, sample fast at 9 bits */
+            state.stableSamples = 0;
+        } else if(rate > SAMPLE_STABLE_RATE){
+            state.stableSamples = 0;
+        } else if(++state.stableSamples >= SAMPLE_STABLE_COUNT && state.sampleLevel < SAMPLE_SLOWEST){
+            state.sampleLevel++;                                                /* settled, one more bit and half the rate */
+            state.stableSamples = 0;
+        }
+    }
+    lastReading = (level == state.sampleLevel && !state.sensorLost) ? reading : SAMPLE_NO_READING;
+#endif
+
+}
+
+/* FAIL-SAFE
+ * A sensor that could not be read DS18B20_LOST_SAMPLES samples in a row is
+ * gone, shorted or on an open bus. The fan goes to the top of the curve,
+ * 100% unless FAN_CURVE_D3 says less, and the LED blinks once per sample
+ * until every sensor answers again. The samples run at the fastest rate
+ * meanwhile, see adaptSampling(). */
+void fanFailSafe(){
+
+    LED_TOGGLE();
+    if(pwmSelect != FAN_LUT_SIZE - 1){
+        pwmSelect = FAN_LUT_SIZE - 1;
+#if FAN_TACH
+        isrFlags.controlDue = 1;                                                /* fanControl() takes it from the curve */
+#else
+        selectPwmDutyCycle(pwmSelect);
+#endif
+    }
+
+}
+
+void sleepPwmStatic(unsigned char prescaler){
+
+#if TELEMETRY
+    telemetryDrain();                                                           /* the frame out before Timer0 stops */
+#endif
+    if(fanCurveCcpr1l[pwmSelect]){
+        SEND_HIGH_CLOCK_PULSE();
+    } else {
+        SEND_LOW_CLOCK_PULSE();
+    }
+    DISABLE_PWM_SERVICE();                                                      /* GP2 follows the latch from here */
+    HAL_CLRWDT();
+    SET_WDT_PRESCALER(prescaler);
+#if FAN_TACH
+    HAL_REG_WRITE(IOC, 0);                                                      /* the fan running down would wake us up */
+    HAL_SLEEP();
+    HAL_NOP();
+    SET_WDT_PRESCALER(WDT_AWAKE_PRESCALER);
+    SET_IOC();
+    PWM_LOAD(0);                                                                /* back to PWM mode, asleep only at 0 */
+#else
+    HAL_SLEEP();                                                                /* the watchdog wakes us up 18ms << prescaler later */
+    HAL_NOP();
+    SET_WDT_PRESCALER(WDT_AWAKE_PRESCALER);
+    selectPwmDutyCycle(pwmSelect);                                              /* back to PWM mode */
+#endif
+
+}
+
+void waitForConversion(){
+
+    owWait();                                                                   /* CONVERT T on the bus */
+    if(pwmIsStatic()){
+        sleepPwmStatic(DS18B20_CONV_WDT(configByte));
+    } else {
+        owStart(OW_SCRIPT_WAIT, DS18B20_CONV_TICKS(configByte));                /* done once the conversion time is over, no polling */
+        owWaitTicks();
+    }
+
+}
+
+void waitForNextSample(){
+
+    if(pwmIsStatic()){
+        sleepPwmStatic(SAMPLE_WDT_PRESCALER(state.sampleLevel));
+    } else {
+        owStart(OW_SCRIPT_WAIT, SAMPLE_WAIT_TICKS(state.sampleLevel));          /* PWM keeps running on Timer2 */
+        owWaitTicks();
+#if TELEMETRY
+        telemetryDrain();                                                       /* long done, the next transaction needs owData */
+#endif
+    }
+
+}
+
 void main(void) {
     
     SYSTEM_Initialize();                                                        /* System initialisation */
     while(1){
-        sendReset();                                                            /* Send Reset plus the Presence to start communicating with DS18B20 */
-        wCommand(DS18B20_SKIP);                                                 /* Send the SKIP command we are addressing only one sensor */
-        wCommand(DS18B20_CONV);                                                 /* Send the CONVERT command to start temperature conversion */
-        DS18B20_BUSY();                                                         /* check if BUS (is low) busy */ 
-        sendReset();                                                            /* Send Reset plus the Presence to start communicating with DS18B20 */
-        wCommand(DS18B20_SKIP);                                                 /* Send the SKIP command we are addressing only one sensor */
-        wCommand(DS18B20_READ_SCRATCHPAD);                                      /* start reading the temperature byte0, byte1 */
-        tempLSB = readByte();                                                   /* Read byte 0 LSB of temperature */
-        tempMSB = readByte();                                                   /* Read byte 1 MSB of temperature */
-        sendReset();                                                            /* Send a RESET to stop reading the scratchpad */
-        plusOrMinus(tempMSB, tempLSB);                                          /* Check if the temperature is positive or negative and if the reading has .5 */
-        temperatureCompare(tempMSB, tempLSB);                                   /* depending the temperature the duty cycle changes */
-        __delay_ms(2000);                                                       /* wait a couple of seconds until the next measurement */
+        HAL_PROFILE_ENTER("loop");                                              /* one sample, start to start */
+        startConversion();                                                      /* CONVERT T, runs in the Timer1 interrupt */
+        waitForConversion();                                                    /* asleep or idle for the conversion time */
+        readTemperatures();                                                     /* byte0, byte1 of every sensor, keep the hottest */
+        if(state.sensorLost < DS18B20_LOST_SAMPLES){
+            temperatureCompare();                                               /* depending the temperature the duty cycle changes */
+        } else {
+            fanFailSafe();                                                      /* no sensor to go by, full cooling */
+        }
+        adaptSampling();                                                        /* sample rate and resolution from dT/dt */
+        resolutionCheck(DS18B20_CONFIG(SAMPLING_ADAPTIVE ? state.sampleLevel : 0)); /* also a sensor powered up again, at 12 bits */
+#if TELEMETRY
+        telemetrySend();                                                        /* Timer0 sends it meanwhile */
+#endif
+        waitForNextSample();
+        HAL_PROFILE_EXIT("loop");
     }
     
 }
@@ -0,0 +1,269 @@
+/*
+ * File:   ds18b20_sim.c
+ * Author: George Nikolaidis
+ *
+ * DS18B20 stand-in, see ds18b20_sim.h
+ * Timings from the DS18B20 datasheet:
+ * reset low >= 480us, presence 15-60us after release lasting 60-240us,
+ * the device samples a write slot 15-60us after the falling edge and
+ * holds a read 0 for 15us minimum, we use the middle of the windows.
+ */
+
+#include <string.h>
+#include "pic12f615_sim.h"
+#include "ds18b20_sim.h"
+
+#define RESET_MIN           SIM_US(480)
+#define PRESENCE_WAIT       SIM_US(30)
+#define PRESENCE_LOW        SIM_US(120)
+#define WRITE_SAMPLE        SIM_US(30)                                          /* low shorter than this is a 1 */
+#define READ_ZERO_HOLD      SIM_US(30)
+#define COPY_TIME           SIM_MS(10)
+
+enum {
+    DS_IDLE,                                                                    /* waiting for a reset */
+    DS_ROM_COMMAND,
+    DS_FUNCTION_COMMAND,
+    DS_WRITE_SCRATCHPAD,
+    DS_SEND,                                                                    /* shifting tx[] out on read slots */
+    DS_MATCH_ROM,                                                               /* comparing 8 ROM bytes */
+    DS_SEARCH_ROM,                                                              /* bit, complement, master's choice, 64 times */
+    DS_BUSY                                                                     /* read slots return 0 until busyUntil */
+};
+
+uint8_t ds18b20_sim_crc8(const uint8_t *data, int len){
+
+    uint8_t crc = 0;
+
+    while(len--){
+        uint8_t in = *data++;
+        for(int i=0;i<8;i++){
+            uint8_t mix = (crc ^ in) & 0x01;                                    /* X^8 + X^5 + X^4 + 1, LSB first */
+            crc >>= 1;
+            if(mix) crc ^= 0x8C;
+            in >>= 1;
+        }
+    }
+    return crc;
+
+}
+
+uint8_t ds18b20_sim_resolution(const struct ds18b20_sim *dev){
+
+    return 9 + ((dev->scratchpad[4] >> 5) & 0x3);
+
+}
+
+uint64_t ds18b20_sim_conversion_cycles(const struct ds18b20_sim *dev){
+
+    return (SIM_US(93750)) << ((dev->scratchpad[4] >> 5) & 0x3);                /* 93.75ms, 187.5ms, 375ms, 750ms */
+
+}
+
+void ds18b20_sim_init(struct ds18b20_sim *dev, const uint8_t *rom, ds18b20_temp_fn temp, void *ctx){
+
+    static const uint8_t defaultRom[7] = {0x28, 0x1D, 0x39, 0x31, 0x02, 0x00, 0x00};
+
+    memset(dev, 0, sizeof(*dev));
+    memcpy(dev->rom, rom ? rom : defaultRom, 7);
+    dev->rom[7]         = ds18b20_sim_crc8(dev->rom, 7);
+    dev->eeprom[0]      = 0x4B;                                                 /* factory TH, TL and 12 bit resolution */
+    dev->eeprom[1]      = 0x46;
+    dev->eeprom[2]      = 0x7F;
+    dev->scratchpad[0]  = DS18B20_SIM_85C & 0xFF;
+    dev->scratchpad[1]  = DS18B20_SIM_85C >> 8;
+    memcpy(&dev->scratchpad[2], dev->eeprom, 3);
+    dev->scratchpad[5]  = 0xFF;
+    dev->scratchpad[6]  = 0x0C;
+    dev->scratchpad[7]  = 0x10;
+    dev->scratchpad[8]  = ds18b20_sim_crc8(dev->scratchpad, 8);
+    dev->temp           = temp;
+    dev->ctx            = ctx;
+    dev->state          = DS_IDLE;
+
+}
+
+static void finishBusy(struct ds18b20_sim *dev, uint64_t now){
+
+    int16_t raw;
+
+    if(!dev->busyUntil || now < dev->busyUntil) return;
+    if(dev->converting){
+        raw = dev->sample;
+        raw &= (int16_t)~((1 << (3 - ((dev->scratchpad[4] >> 5) & 0x3))) - 1); /* undefined low bits read as 0 */
+        dev->scratchpad[0] = (uint8_t)(raw & 0xFF);
+        dev->scratchpad[1] = (uint8_t)((uint16_t)raw >> 8);
+        dev->scratchpad[8] = ds18b20_sim_crc8(dev->scratchpad, 8);
+        dev->converting    = 0;
+    }
+    dev->busyUntil = 0;
+
+}
+
+static void send(struct ds18b20_sim *dev, const uint8_t *data, uint8_t len){
+
+    memcpy(dev->tx, data, len);
+    dev->txLen  = len;
+    dev->txBit  = 0;
+    dev->state  = DS_SEND;
+
+}
+
+static void functionCommand(struct ds18b20_sim *dev, uint8_t cmd, uint64_t now){
+
+    switch(cmd){
+        case 0x44:                                                              /* CONVERT T */
+            dev->sample     = dev->temp ? dev->temp(now, dev->ctx) : 25 * 16;
+            dev->converting = 1;
+            dev->busyUntil  = now + ds18b20_sim_conversion_cycles(dev);
+            dev->conversions++;
+            dev->state      = DS_BUSY;
+            if(dev->onConvert) dev->onConvert(dev, now);
+            break;
+        case 0xBE:                                                              /* READ SCRATCHPAD */
+            send(dev, dev->scratchpad, 9);
+            if(dev->onRead) dev->onRead(dev, now);
+            break;
+        case 0x4E:                                                              /* WRITE SCRATCHPAD */
+            dev->nbytes = 0;
+            dev->state  = DS_WRITE_SCRATCHPAD;
+            break;
+        case 0x48:                                                              /* COPY SCRATCHPAD */
+            memcpy(dev->eeprom, &dev->scratchpad[2], 3);
+            dev->eepromWrites++;
+            dev->busyUntil  = now + COPY_TIME;
+            dev->state      = DS_BUSY;
+            break;
+        case 0xB8:                                                              /* RECALL E2 */
+            memcpy(&dev->scratchpad[2], dev->eeprom, 3);
+            dev->scratchpad[8] = ds18b20_sim_crc8(dev->scratchpad, 8);
+            dev->state  = DS_IDLE;
+            break;
+        default:
+            dev->state  = DS_IDLE;
+            break;
+    }
+
+}
+
+static void receiveByte(struct ds18b20_sim *dev, uint8_t data, uint64_t now){
+
+    switch(dev->state){
+        case DS_ROM_COMMAND:
+            if(data == 0xCC){                                                   /* SKIP ROM */
+                dev->state = DS_FUNCTION_COMMAND;
+            } else if(data == 0x33){                                            /* READ ROM */
+                send(dev, dev->rom, 8);
+            } else if(data == 0x55){                                            /* MATCH ROM */
+                dev->nbytes = 0;
+                dev->state  = DS_MATCH_ROM;
+            } else if(data == 0xF0){                                            /* SEARCH ROM */
+                dev->searchBit  = 0;
+                dev->searchStep = 0;
+                dev->state      = DS_SEARCH_ROM;
+            } else {
+                dev->state = DS_IDLE;
+            }
+            break;
+        case DS_MATCH_ROM:
+            if(data != dev->rom[dev->nbytes]){
+                dev->state = DS_IDLE;                                           /* not us, wait for the next reset */
+            } else if(++dev->nbytes == 8){
+                dev->state = DS_FUNCTION_COMMAND;
+            }
+            break;
+        case DS_FUNCTION_COMMAND:
+            functionCommand(dev, data, now);
+            break;
+        case DS_WRITE_SCRATCHPAD:
+            if(dev->nbytes == 2) data = (data & 0x60) | 0x1F;                   /* config: only R1 R0 are writable */
+            dev->scratchpad[2 + dev->nbytes] = data;
+            dev->scratchpad[8] = ds18b20_sim_crc8(dev->scratchpad, 8);
+            if(++dev->nbytes == 3) dev->state = DS_IDLE;
+            break;
+        default:
+            break;
+    }
+
+}
+
+void ds18b20_sim_edge(struct ds18b20_sim *dev, int masterLow, uint64_t now){
+
+    uint64_t low;
+    int bit;
+
+    if(dev->gone) return;
+    finishBusy(dev, now);
+    if(masterLow){
+        dev->fallAt     = now;
+        dev->readSlot   = 0;
+        if(dev->state == DS_SEARCH_ROM && dev->searchStep < 2){                 /* our ROM bit, then its complement */
+            bit = ((dev->rom[dev->searchBit >> 3] >> (dev->searchBit & 7)) & 0x1) ^ dev->searchStep;
+            dev->searchStep++;
+            dev->readSlot = 1;
+            if(!bit){
+                dev->holdFrom   = now;
+                dev->holdUntil  = now + READ_ZERO_HOLD;
+            }
+        } else if(dev->state == DS_SEND){                                       /* read slot, a 0 is held low for a while */
+            bit = 1;
+            if(dev->dropAfter && dev->txBit == dev->dropAfter){
+                dev->gone = 1;                                                  /* pulled off the bus mid-byte */
+                return;
+            }
+            if(dev->txBit < dev->txLen * 8){
+                bit = (dev->tx[dev->txBit >> 3] >> (dev->txBit & 7)) & 0x1;
+                dev->txBit++;
+            }
+            if(!bit){
+                dev->holdFrom   = now;
+                dev->holdUntil  = now + READ_ZERO_HOLD;
+            }
+        } else if(dev->state == DS_BUSY && dev->busyUntil){
+            dev->holdFrom   = now;
+            dev->holdUntil  = now + READ_ZERO_HOLD;
+        }
+        return;
+    }
+
+    low = now - dev->fallAt;
+    if(low >= RESET_MIN){                                                       /* reset, answer with a presence pulse */
+        dev->resets++;
+        dev->state      = DS_ROM_COMMAND;
+        dev->nbits      = 0;
+        dev->shift      = 0;
+        dev->holdFrom   = now + PRESENCE_WAIT;
+        dev->holdUntil  = now + PRESENCE_WAIT + PRESENCE_LOW;
+        return;
+    }
+    if(low > SIM_US(120)) dev->badSlots++;                                      /* longer than a slot, shorter than a reset */
+    if(dev->readSlot) return;
+    if(dev->state == DS_SEARCH_ROM){                                            /* the master writes the direction it takes */
+        bit = low < WRITE_SAMPLE;
+        if(bit != ((dev->rom[dev->searchBit >> 3] >> (dev->searchBit & 7)) & 0x1)){
+            dev->state = DS_IDLE;                                               /* dropped out of this pass */
+        } else if(++dev->searchBit == 64){
+            dev->state = DS_FUNCTION_COMMAND;
+        }
+        dev->searchStep = 0;
+        return;
+    }
+    if(dev->state == DS_ROM_COMMAND || dev->state == DS_FUNCTION_COMMAND ||
+       dev->state == DS_WRITE_SCRATCHPAD || dev->state == DS_MATCH_ROM){
+        bit = low < WRITE_SAMPLE;
+        dev->shift = (uint8_t)((dev->shift >> 1) | (bit ? 0x80 : 0));          /* LSB first */
+        if(++dev->nbits == 8){
+            dev->nbits = 0;
+            receiveByte(dev, dev->shift, now);
+        }
+    }
+
+}
+
+int ds18b20_sim_pulls_low(struct ds18b20_sim *dev, uint64_t now){
+
+    if(dev->gone) return 0;
+    finishBusy(dev, now);
+    return now >= dev->holdFrom && now < dev->holdUntil;
+
+}
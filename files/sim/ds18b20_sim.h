@@ -0,0 +1,67 @@
+/*
+ * File:   ds18b20_sim.h
+ * Author: George Nikolaidis
+ *
+ * Scripted DS18B20 stand-in for the PIC12F615 simulator.
+ * The device watches the edges the PIC makes on GP4 and decodes reset,
+ * write and read slots by the length of the low pulse, like the real part.
+ * The temperature it converts comes from a script callback.
+ * Externally powered: it does not hold the bus during CONVERT T or COPY,
+ * read slots return 0 until they are done.
+ * For fault tests a device can be taken off the bus, straight away (gone)
+ * or some bits into the next thing it sends (dropAfter).
+ */
+
+#ifndef DS18B20_SIM_H
+#define DS18B20_SIM_H
+
+#include <stdint.h>
+
+#define DS18B20_SIM_85C         0x0550                                          /* power on value of the temperature register */
+
+typedef int16_t (*ds18b20_temp_fn)(uint64_t cycles, void *ctx);                 /* 1/16 Celsius at a given time */
+
+struct ds18b20_sim {
+    uint8_t  rom[8];                                                            /* family 0x28, serial, crc */
+    uint8_t  scratchpad[9];
+    uint8_t  eeprom[3];                                                         /* TH, TL, CONFIG */
+
+    ds18b20_temp_fn temp;
+    void    *ctx;
+
+    int      state;
+    uint8_t  shift;                                                             /* bits received */
+    uint8_t  nbits;
+    uint8_t  nbytes;
+    uint8_t  tx[9];
+    uint8_t  txLen;
+    uint8_t  txBit;
+    uint8_t  readSlot;                                                          /* the current low pulse is a read slot */
+    uint8_t  searchBit;
+    uint8_t  searchStep;
+
+    uint64_t fallAt;                                                            /* master pulled the bus low */
+    uint64_t holdFrom;                                                          /* the device pulls the bus low */
+    uint64_t holdUntil;
+    uint64_t busyUntil;                                                         /* end of CONVERT T or COPY SCRATCHPAD */
+    int16_t  sample;                                                            /* temperature taken at CONVERT T */
+    uint8_t  converting;
+    uint8_t  gone;                                                              /* off the bus, sees nothing, answers nothing */
+    uint8_t  dropAfter;                                                         /* bits into the next send, then gone, 0 never */
+
+    uint32_t resets;                                                            /* statistics */
+    uint32_t conversions;
+    uint32_t eepromWrites;
+    uint32_t badSlots;
+    void   (*onConvert)(struct ds18b20_sim *dev, uint64_t cycles);
+    void   (*onRead)(struct ds18b20_sim *dev, uint64_t cycles);                /* READ SCRATCHPAD */
+};
+
+void    ds18b20_sim_init(struct ds18b20_sim *dev, const uint8_t *rom, ds18b20_temp_fn temp, void *ctx);
+void    ds18b20_sim_edge(struct ds18b20_sim *dev, int masterLow, uint64_t cycles);
+int     ds18b20_sim_pulls_low(struct ds18b20_sim *dev, uint64_t cycles);
+uint8_t ds18b20_sim_crc8(const uint8_t *data, int len);
+uint8_t ds18b20_sim_resolution(const struct ds18b20_sim *dev);
+uint64_t ds18b20_sim_conversion_cycles(const struct ds18b20_sim *dev);
+
+#endif
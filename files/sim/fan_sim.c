@@ -0,0 +1,58 @@
+/*
+ * File:   fan_sim.c
+ * Author: George Nikolaidis
+ *
+ * PWM fan stand-in, see fan_sim.h
+ * The duty is what GP2 drives at each call, averaged over a PWM period,
+ * the fan motor driver does the same. Calls are at most FAN_SIM_STEP
+ * apart and land on the tach edges, so an edge is never late.
+ */
+
+#include <math.h>
+#include "pic12f615_sim.h"
+#include "fan_sim.h"
+
+void fan_sim_init(struct fan_sim *fan, unsigned rpmMax, unsigned tauMs, int tachPin){
+
+    fan->rpmMax         = rpmMax;
+    fan->startPermille  = 100;
+    fan->tauMs          = tauMs;
+    fan->tachPin        = tachPin;
+    fan->stalled        = 0;
+    fan->rpm            = 0.0;
+    fan->quarter        = 0.0;
+    fan->last           = 0;
+    fan->level          = 1;                                                    /* pulled up */
+    fan->edges          = 0;
+    sim_pin_set(tachPin, 1);
+
+}
+
+uint64_t fan_sim_step(void *ctx, uint64_t cycles){
+
+    struct fan_sim *fan = ctx;
+    unsigned duty       = sim_pwm_output_permille();
+    double   dt         = (cycles - fan->last) * SIM_NS_PER_CYCLE / 1e9;        /* seconds */
+    double   target     = duty >= fan->startPermille ? fan->rpmMax * duty / 1000.0 : 0.0;
+    double   left;
+
+    fan->last       = cycles;
+    fan->quarter   += fan->rpm * dt / 15.0;                                     /* 4 tach edges per turn */
+    if(fan->stalled){
+        fan->rpm    = 0.0;
+    } else {
+        fan->rpm   += (target - fan->rpm) * (1.0 - exp(-dt * 1000.0 / fan->tauMs));
+    }
+    if(fan->quarter >= 1.0 - 1e-9){
+        fan->quarter = fan->quarter >= 2.0 ? 0.0 : fan->quarter - 1.0;         /* one edge a call, we land on them */
+        if(fan->quarter < 0.0) fan->quarter = 0.0;
+        fan->level  ^= 1;
+        fan->edges++;
+        sim_pin_set(fan->tachPin, fan->level);
+    }
+    if(fan->rpm <= 0.0) return cycles + FAN_SIM_STEP;
+    left = (1.0 - fan->quarter) * 15.0 / fan->rpm;                              /* seconds to the next edge */
+    if(left * 1e9 / SIM_NS_PER_CYCLE >= FAN_SIM_STEP) return cycles + FAN_SIM_STEP;
+    return cycles + (uint64_t)ceil(left * 1e9 / SIM_NS_PER_CYCLE);
+
+}
@@ -0,0 +1,38 @@
+/*
+ * File:   fan_sim.h
+ * Author: George Nikolaidis
+ *
+ * 4 pin PWM fan stand-in for the PIC12F615 simulator, a plant, see
+ * sim_plant() in pic12f615_sim.h.
+ * The speed the fan settles at is rpmMax times the duty GP2 drives, below
+ * startPermille it does not turn at all. The rotor follows that speed with
+ * a first order lag, tau, its inertia. The open collector tach output gives
+ * two pulses per revolution on the tach pin, the pull-up is taken as there.
+ * A locked rotor (stalled) stops at once and the tach stays where it is.
+ */
+
+#ifndef FAN_SIM_H
+#define FAN_SIM_H
+
+#include <stdint.h>
+
+#define FAN_SIM_STEP            SIM_MS(1)                                       /* longest time between two plant calls */
+
+struct fan_sim {
+    unsigned rpmMax;                                                            /* at 100% */
+    unsigned startPermille;                                                     /* lowest duty it turns at */
+    unsigned tauMs;                                                             /* inertia, time to 63% of a step */
+    int      tachPin;
+    int      stalled;                                                           /* locked rotor */
+
+    double   rpm;
+    double   quarter;                                                           /* of a turn since the last tach edge */
+    uint64_t last;
+    int      level;                                                             /* tach output */
+    uint32_t edges;
+};
+
+void     fan_sim_init(struct fan_sim *fan, unsigned rpmMax, unsigned tauMs, int tachPin);
+uint64_t fan_sim_step(void *ctx, uint64_t cycles);                              /* a sim_plant_fn */
+
+#endif
@@ -0,0 +1,511 @@
+/*
+ * File:   fleet_sim.c
+ * Author: George Nikolaidis
+ *
+ * Fleet of simulated boards against a set of fan curves, see fleet_sim.h
+ * A rack slot is one lumped node, the air and heatsink the sensor sits on:
+ *     C dT/dt = P(t) - (Gpassive + Gfan * rpm / rpmMax) * (T - Tambient)
+ * The load P steps between idle and busy every 60 to 180s. The fan takes
+ * FLEET_FAN_WATTS at its full speed and the cube of the speed below it, as
+ * the fan laws have it.
+ * Per policy it sums the fan energy, the peak temperature, the changes of
+ * the curve step duty (GP2 without the tach, the PI trims in between are
+ * not counted, as in fanctl-sim -r) and the time to setpoint: after every load step, how long until
+ * the temperature stays within FLEET_SETTLED of where that step ends.
+ */
+
+#define _DEFAULT_SOURCE                                                         /* fork, mmap, MAP_ANONYMOUS with -std=c99 */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "pic12f615_sim.h"
+#include "ds18b20_sim.h"
+#include "fan_sim.h"
+#include "fleet_sim.h"
+#include "../fan_curve.h"
+
+#ifndef FAN_TACH
+#define FAN_TACH            1                                                   /* as nmain.c */
+#endif
+
+#define FLEET_MAX_WORKERS   256
+#define FLEET_MAX_STEPS     128                                                 /* load steps per board */
+#define FLEET_FAN_WATTS     4.0                                                 /* a 120mm fan at full speed */
+#define FLEET_FAN_TAU_MS    1500
+#define FLEET_G_PASSIVE     0.5                                                 /* W/K with the fan stopped */
+#define FLEET_TRACE         SIM_MS(250)                                         /* temperature kept every 250ms for the settling */
+#define FLEET_TRACE_MAX     (180 * 4 + 1)                                       /* the longest step */
+#define FLEET_SETTLED       0.5                                                 /* C */
+
+                                                                                /* nmain.c */
+void firmware_main(void);
+extern unsigned char fanCurveCcpr1l[], fanCurveCcp1con[];                      /* HAL_ROM, writable on the host */
+extern unsigned char pwmSelect;
+#if FAN_TACH
+extern unsigned int fanCurveRpm[];
+extern unsigned int fanDutyMin;
+#endif
+
+/* FLEET TABLE
+ * One shared mapping, the arrays carved out of it in a row. */
+struct fleet {
+    int       boards;
+    int       policies;
+    int       jobs;                                                             /* policy * boards + board */
+    int       workers;
+    double    seconds;
+
+    uint32_t *seed;                                                             /* per board */
+    float    *ambient;
+    float    *capacity;
+    float    *gFan;
+    float    *heatIdle;
+    float    *heatBusy;
+    uint32_t *rpmMax;
+
+    double   *energy;                                                           /* per job, J */
+    float    *peak;                                                             /* C */
+    uint32_t *dutyChanges;
+    double   *settleSum;                                                        /* s */
+    uint32_t *settleCount;
+    uint8_t  *done;
+
+    uint64_t *deque;                                                            /* per worker, front << 32 | back */
+    uint32_t *steals;
+};
+
+static struct fleet fleet;
+static struct fleet_policy policy[FLEET_MAX_POLICIES];
+
+/* POLICIES */
+int fleet_policy_parse(struct fleet_policy *p, const char *arg){
+
+    const char *eq = strchr(arg, '=');
+    char *end;
+    size_t len;
+
+    if(!eq || eq == arg) return -1;
+    len = (size_t)(eq - arg) < sizeof(p->name) - 1 ? (size_t)(eq - arg) : sizeof(p->name) - 1;
+    memcpy(p->name, arg, len);
+    p->name[len] = 0;
+    arg = eq + 1;
+    for(int i=0;i<4;i++){
+        p->t[i] = (int)strtol(arg, &end, 10);
+        if(*end != ':') return -1;
+        p->d[i] = (int)strtol(end + 1, &end, 10);
+        if(*end != (i < 3 ? ',' : '\0')) return -1;
+        arg = end + 1;
+    }
+    if(p->t[0] <= FAN_LUT_BASE || p->t[3] > FAN_LUT_BASE + FAN_LUT_SIZE - 1) return -1;  /* the table the build has */
+    if(p->t[0] >= p->t[1] || p->t[1] >= p->t[2] || p->t[2] >= p->t[3]) return -1;
+    for(int i=0;i<4;i++){
+        if(p->d[i] < 0 || p->d[i] > 100) return -1;
+    }
+    return 0;
+
+}
+
+int fleet_policy_defaults(struct fleet_policy *p){
+
+    static const char *curves[] = {
+        "quiet=" "33:15,48:60,57:90,60:100",                                   /* later, the built curve 3C up */
+        "cool="  "30:25,40:60,50:90,55:100"                                    /* earlier and steeper */
+    };
+    int n = 0;
+
+    strcpy(p[n].name, "built");
+    p[n].t[0] = FAN_CURVE_T0; p[n].t[1] = FAN_CURVE_T1; p[n].t[2] = FAN_CURVE_T2; p[n].t[3] = FAN_CURVE_T3;
+    p[n].d[0] = FAN_CURVE_D0; p[n].d[1] = FAN_CURVE_D1; p[n].d[2] = FAN_CURVE_D2; p[n].d[3] = FAN_CURVE_D3;
+    n++;
+    for(int i=0;i<2;i++){
+        if(!fleet_policy_parse(&p[n], curves[i])) n++;                          /* unless the build moved FAN_LUT_BASE away */
+    }
+    return n;
+
+}
+
+static long policyDuty10(const struct fleet_policy *p, int t){
+                                                                                /* FAN_DUTY10() of fan_curve.h with the policy's breakpoints */
+    long da, db;
+
+    if(t < p->t[0]) return 0;
+    for(int i=0;i<3;i++){
+        if(t < p->t[i + 1]){
+            da = p->d[i] * PWM_DUTY_MAX / 100;
+            db = p->d[i + 1] * PWM_DUTY_MAX / 100;
+            return da + ((db - da) * (t - p->t[i]) + (p->t[i + 1] - p->t[i]) / 2) / (p->t[i + 1] - p->t[i]);
+        }
+    }
+    return p->d[3] * PWM_DUTY_MAX / 100;
+
+}
+
+static void policyLoad(const struct fleet_policy *p){
+
+    long duty;
+
+    for(int i=0;i<FAN_LUT_SIZE;i++){
+        duty = policyDuty10(p, FAN_LUT_BASE + i);
+        fanCurveCcpr1l[i]  = (unsigned char)(duty >> 2);
+        fanCurveCcp1con[i] = (unsigned char)(0x0C | ((duty & 0x3) << 4));
+#if FAN_TACH
+        fanCurveRpm[i]     = (unsigned int)(duty * FAN_RPM_MAX / PWM_DUTY_MAX);
+#endif
+    }
+#if FAN_TACH
+    fanDutyMin = (unsigned int)(p->d[0] * PWM_DUTY_MAX / 100);                 /* FAN_D10(FAN_CURVE_D0), the PI clamp */
+#endif
+
+}
+
+/* RACK SLOT
+ * Made from the seed of the board in the worker, the same for every policy. */
+static uint32_t slotRandom(uint32_t *state){
+
+    *state ^= *state << 13;                                                     /* xorshift32 */
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+
+}
+
+static double slotUniform(uint32_t *state, double lo, double hi){
+
+    return lo + (hi - lo) * (slotRandom(state) % 10000u) / 10000.0;
+
+}
+
+struct slot {
+    double   temp;
+    double   ambient;
+    double   capacity;
+    double   gFan;
+    double   heat;
+    double   heatIdle;
+    double   heatBusy;
+    double   energy;
+    double   peak;
+    uint64_t last;
+    uint32_t rng;
+    int      busy;
+    int      steps;
+    uint64_t stepEnd;
+    uint64_t traceAt;
+    int      traceLen;
+    float    trace[FLEET_TRACE_MAX];
+    double   settleSum;
+    uint32_t settleCount;
+    unsigned curveLevel;                                                        /* the duty of the curve step, see below */
+    uint32_t curveChanges;
+};
+
+static struct slot slot;
+static struct fan_sim fan;
+static struct ds18b20_sim sensor;
+
+static void slotStep(struct slot *s, uint64_t now){
+
+    int i;
+
+    if(s->steps){                                                               /* the first starts from a guess, not from a step */
+        for(i=s->traceLen-1;i>=0 && fabs(s->trace[i] - s->temp) <= FLEET_SETTLED;i--);
+        s->settleSum += (i + 1) * (FLEET_TRACE * SIM_NS_PER_CYCLE / 1e9);
+        s->settleCount++;
+    }
+    s->steps++;
+    s->busy     = s->steps > 1 && !s->busy;
+    s->heat     = s->busy ? s->heatBusy : s->heatIdle;
+    s->stepEnd  = now + SIM_MS(1000 * (60 + slotRandom(&s->rng) % 121));
+    s->traceLen = 0;
+    s->traceAt  = now;
+
+}
+
+static uint64_t slotPlant(void *ctx, uint64_t now){
+
+    struct slot *s  = ctx;
+    double dt       = (now - s->last) * SIM_NS_PER_CYCLE / 1e9;
+    double speed    = fan.rpm / fan.rpmMax;                                     /* over the interval that ends now */
+    uint64_t next;
+#if FAN_TACH
+    unsigned duty;
+#endif
+
+    s->last     = now;
+    s->temp    += dt * (s->heat - (FLEET_G_PASSIVE + s->gFan * speed) * (s->temp - s->ambient)) / s->capacity;
+    s->energy  += dt * FLEET_FAN_WATTS * speed * speed * speed;
+    if(s->temp > s->peak) s->peak = s->temp;
+    if(now >= s->traceAt && s->traceLen < FLEET_TRACE_MAX){
+        s->trace[s->traceLen++] = (float)s->temp;
+        s->traceAt += FLEET_TRACE;
+    }
+    if(now >= s->stepEnd && s->steps < FLEET_MAX_STEPS){
+        slotStep(s, now);
+    }
+    next = fan_sim_step(&fan, now);                                             /* at most FAN_SIM_STEP on */
+#if FAN_TACH
+    duty = ((unsigned)fanCurveCcpr1l[pwmSelect] << 2) | ((fanCurveCcp1con[pwmSelect] >> 4) & 0x3);
+    if(duty != s->curveLevel){
+        s->curveLevel = duty;                                                   /* a new curve step, not a PI trim */
+        s->curveChanges++;
+    }
+#endif
+    return next;
+
+}
+
+static int16_t slotTemp(uint64_t now, void *ctx){
+
+    const struct slot *s = ctx;
+
+    (void)now;                                                                  /* the plant is never more than 1ms behind */
+    return (int16_t)lround(s->temp * 16.0);
+
+}
+
+static void runBoard(int job){
+
+    int      board  = job % fleet.boards;
+    uint8_t  rom[7] = {0x28, 0x46, 0x4C, 0x45, 0x45, 0x54, 0x00};
+
+    sim_reset();
+    policyLoad(&policy[job / fleet.boards]);
+    memset(&slot, 0, sizeof(slot));
+    slot.rng        = fleet.seed[board];
+    slot.ambient    = fleet.ambient[board];
+    slot.capacity   = fleet.capacity[board];
+    slot.gFan       = fleet.gFan[board];
+    slot.heatIdle   = fleet.heatIdle[board];
+    slot.heatBusy   = fleet.heatBusy[board];
+    slot.temp       = slot.ambient + slot.heatIdle / (FLEET_G_PASSIVE + slot.gFan / 2);
+    slot.peak       = slot.temp;
+    slotStep(&slot, 0);
+    fan_sim_init(&fan, fleet.rpmMax[board], FLEET_FAN_TAU_MS, SIM_BIT_GP1);
+    sim_plant(slotPlant, &slot);
+    ds18b20_sim_init(&sensor, rom, slotTemp, &slot);
+    sim_attach(&sensor);
+    sim_run(firmware_main, (uint64_t)(fleet.seconds * 2000000.0));
+
+    fleet.energy[job]       = slot.energy;
+    fleet.peak[job]         = (float)slot.peak;
+#if FAN_TACH
+    fleet.dutyChanges[job]  = slot.curveChanges;
+#else
+    fleet.dutyChanges[job]  = sim.pwm_changes;                                  /* the curve step is the duty */
+#endif
+    fleet.settleSum[job]    = slot.settleSum;
+    fleet.settleCount[job]  = slot.settleCount;
+    fleet.done[job]         = 1;
+
+}
+
+/* WORK STEALING
+ * A range of jobs per worker packed in one word, so one compare and swap
+ * takes a job from either end. The owner takes from the back, a thief from
+ * the front, they meet in the middle. */
+static int takeJob(int worker){
+
+    uint64_t *d = &fleet.deque[worker];
+    uint64_t old = __atomic_load_n(d, __ATOMIC_ACQUIRE);
+    uint32_t front, back;
+
+    do {
+        front   = (uint32_t)(old >> 32);
+        back    = (uint32_t)old;
+        if(front >= back) return -1;
+    } while(!__atomic_compare_exchange_n(d, &old, ((uint64_t)front << 32) | (back - 1), 0,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+    return (int)(back - 1);
+
+}
+
+static int stealJob(int worker){
+
+    uint64_t *d;
+    uint64_t old;
+    uint32_t front, back;
+
+    for(int i=1;i<fleet.workers;i++){
+        d   = &fleet.deque[(worker + i) % fleet.workers];
+        old = __atomic_load_n(d, __ATOMIC_ACQUIRE);
+        for(;;){
+            front   = (uint32_t)(old >> 32);
+            back    = (uint32_t)old;
+            if(front >= back) break;
+            if(__atomic_compare_exchange_n(d, &old, ((uint64_t)(front + 1) << 32) | back, 0,
+                                           __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)){
+                __atomic_fetch_add(fleet.steals, 1, __ATOMIC_RELAXED);
+                return (int)front;
+            }
+        }
+    }
+    return -1;
+
+}
+
+static void worker(int id){
+
+    int   job;
+    pid_t pid;
+
+    while((job = takeJob(id)) >= 0 || (job = stealJob(id)) >= 0){
+        pid = fork();                                                           /* the board from power on, globals and all */
+        if(pid == 0){
+            runBoard(job);
+            _exit(0);
+        }
+        if(pid > 0) waitpid(pid, NULL, 0);                                      /* a board that crashed is left not done */
+    }
+    _exit(0);
+
+}
+
+/* FLEET */
+static void *carve(uint8_t **at, size_t size){
+
+    void *p = *at;
+
+    *at += (size + 63) & ~(size_t)63;                                           /* a cache line per array start */
+    return p;
+
+}
+
+static int fleetMap(int boards, int policies, int workers){
+
+    size_t   jobs = (size_t)boards * policies;
+    size_t   size = 64 * 24 + (size_t)boards * 7 * 4 + jobs * (8 + 4 + 4 + 8 + 4 + 1) + (size_t)workers * 8 + 4;
+    uint8_t *at   = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    if(at == MAP_FAILED) return -1;
+    fleet.seed          = carve(&at, boards * sizeof(uint32_t));
+    fleet.ambient       = carve(&at, boards * sizeof(float));
+    fleet.capacity      = carve(&at, boards * sizeof(float));
+    fleet.gFan          = carve(&at, boards * sizeof(float));
+    fleet.heatIdle      = carve(&at, boards * sizeof(float));
+    fleet.heatBusy      = carve(&at, boards * sizeof(float));
+    fleet.rpmMax        = carve(&at, boards * sizeof(uint32_t));
+    fleet.energy        = carve(&at, jobs * sizeof(double));
+    fleet.peak          = carve(&at, jobs * sizeof(float));
+    fleet.dutyChanges   = carve(&at, jobs * sizeof(uint32_t));
+    fleet.settleSum     = carve(&at, jobs * sizeof(double));
+    fleet.settleCount   = carve(&at, jobs * sizeof(uint32_t));
+    fleet.done          = carve(&at, jobs);
+    fleet.deque         = carve(&at, workers * sizeof(uint64_t));
+    fleet.steals        = carve(&at, sizeof(uint32_t));
+    return 0;
+
+}
+
+static void fleetSlots(void){
+
+    uint32_t rng;
+
+    for(int b=0;b<fleet.boards;b++){
+        rng = 0x9E3779B9u * (uint32_t)(b + 1);
+        if(!rng) rng = 1;
+        fleet.seed[b]       = rng;
+        fleet.ambient[b]    = (float)slotUniform(&rng, 18.0, 32.0);             /* C */
+        fleet.capacity[b]   = (float)slotUniform(&rng, 200.0, 600.0);           /* J/K */
+        fleet.gFan[b]       = (float)slotUniform(&rng, 3.0, 6.0);               /* W/K at full speed */
+        fleet.heatIdle[b]   = (float)slotUniform(&rng, 10.0, 30.0);             /* W */
+        fleet.heatBusy[b]   = (float)slotUniform(&rng, 60.0, 140.0);
+        fleet.rpmMax[b]     = (uint32_t)slotUniform(&rng, 2200.0, 3400.0);
+        fleet.seed[b]       = rng;                                              /* the load steps go on from here */
+    }
+
+}
+
+static void fleetReport(double wall){
+
+    double   hours = fleet.seconds / 3600.0;
+    int      failed = 0;
+
+    printf("  policy      curve                        fan Wh/h  peak C avg    max  duty changes/h  to setpoint s\n");
+    for(int p=0;p<fleet.policies;p++){
+        double   energy = 0.0, peakSum = 0.0, peakMax = -273.0, changes = 0.0, settle = 0.0;
+        uint32_t steps = 0;
+        int      n = 0;
+        char     curve[64];
+
+        for(int j=p*fleet.boards;j<(p+1)*fleet.boards;j++){
+            if(!fleet.done[j]){
+                failed++;
+                continue;
+            }
+            energy  += fleet.energy[j];
+            peakSum += fleet.peak[j];
+            if(fleet.peak[j] > peakMax) peakMax = fleet.peak[j];
+            changes += fleet.dutyChanges[j];
+            settle  += fleet.settleSum[j];
+            steps   += fleet.settleCount[j];
+            n++;
+        }
+        snprintf(curve, sizeof(curve), "%d:%d,%d:%d,%d:%d,%d:%d", policy[p].t[0], policy[p].d[0], policy[p].t[1],
+                 policy[p].d[1], policy[p].t[2], policy[p].d[2], policy[p].t[3], policy[p].d[3]);
+        if(!n){
+            printf("  %-10s  %-27s  no board finished\n", policy[p].name, curve);
+            continue;
+        }
+        printf("  %-10s  %-27s  %8.2f  %10.1f  %5.1f  %14.0f  %13.1f\n", policy[p].name, curve,
+               energy / 3600.0 / n / hours, peakSum / n, peakMax, changes / n / hours, steps ? settle / steps : 0.0);
+    }
+    printf("simulated %.0f s in %.2f s, %.0f x real time, %.0f per worker, %u steals",
+           fleet.seconds * fleet.jobs, wall, fleet.seconds * fleet.jobs / wall,
+           fleet.seconds * fleet.jobs / wall / fleet.workers, *fleet.steals);
+    if(failed) printf(", %d boards did not finish", failed);
+    printf("\n");
+
+}
+
+int fleet_run(const struct fleet_policy *policies, int npolicies, int boards, double seconds, int workers){
+
+    struct timespec t0, t1;
+    pid_t  pid[FLEET_MAX_WORKERS];
+    int    started = 0;
+    int    jobs;
+
+    if(npolicies < 1 || npolicies > FLEET_MAX_POLICIES || boards < 1) return 1;
+    if(workers < 1) workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if(workers < 1) workers = 1;
+    if(workers > FLEET_MAX_WORKERS) workers = FLEET_MAX_WORKERS;
+    memcpy(policy, policies, sizeof(*policies) * npolicies);
+    jobs            = boards * npolicies;
+    if(workers > jobs) workers = jobs;
+    if(fleetMap(boards, npolicies, workers)) return 1;
+    fleet.boards    = boards;
+    fleet.policies  = npolicies;
+    fleet.jobs      = jobs;
+    fleet.workers   = workers;
+    fleet.seconds   = seconds;
+    fleetSlots();
+    for(int w=0;w<workers;w++){
+        uint32_t front  = (uint32_t)((uint64_t)jobs * w / workers);
+        uint32_t back   = (uint32_t)((uint64_t)jobs * (w + 1) / workers);
+        fleet.deque[w]  = ((uint64_t)front << 32) | back;
+    }
+    printf("fleet %d boards x %d policies, %.0f s each, %d workers\n", boards, npolicies, seconds, workers);
+    fflush(stdout);                                                             /* not again from every fork */
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for(int w=0;w<workers;w++){
+        pid[w] = fork();
+        if(pid[w] == 0) worker(w);
+        if(pid[w] > 0) started++;
+    }
+    if(!started) return 1;
+    for(int w=0;w<workers;w++){
+        if(pid[w] > 0) waitpid(pid[w], NULL, 0);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    fleetReport((double)(t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+    for(int j=0;j<jobs;j++){
+        if(!fleet.done[j]) return 1;
+    }
+    return 0;
+
+}
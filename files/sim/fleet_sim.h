@@ -0,0 +1,40 @@
+/*
+ * File:   fleet_sim.h
+ * Author: George Nikolaidis
+ *
+ * A fleet of boards for comparing fan curves before they are flashed.
+ * Every board is nmain.c on its own simulated pic, with a DS18B20 and a fan
+ * in a lumped thermal model of a rack slot: an ambient, a heat load that
+ * steps between idle and busy, a heat capacity, and a conductance to the
+ * ambient that grows with the fan speed. The slots are made from a seed, so
+ * every policy meets the same slots.
+ *
+ * nmain.c keeps its state in globals and so does the simulator, so a board
+ * runs in a process of its own, forked from one that never ran the
+ * firmware: every board starts from power on. One worker process per core
+ * forks the boards one after the other. The jobs, boards times policies,
+ * are split into a range per worker, a worker takes from the back of its
+ * own and steals from the front of another's when it runs dry.
+ *
+ * The fleet table is a struct of arrays in shared memory, the slot
+ * parameters per board read by the workers, the results per job written
+ * once at the end of a board, the summary per policy reads them in a row.
+ */
+
+#ifndef FLEET_SIM_H
+#define FLEET_SIM_H
+
+#define FLEET_MAX_POLICIES      8
+#define FLEET_SECONDS           600                                             /* simulated per board */
+
+struct fleet_policy {
+    char     name[16];
+    int      t[4];                                                              /* breakpoints as FAN_CURVE_T0..T3, C */
+    int      d[4];                                                              /* and FAN_CURVE_D0..D3, % */
+};
+
+int fleet_policy_parse(struct fleet_policy *policy, const char *arg);          /* name=t0:d0,t1:d1,t2:d2,t3:d3 */
+int fleet_policy_defaults(struct fleet_policy *policy);                         /* the curve built in and two more, returns how many */
+int fleet_run(const struct fleet_policy *policies, int npolicies, int boards, double seconds, int workers);
+
+#endif
@@ -0,0 +1,826 @@
+/*
+ * File:   pic12f615_sim.c
+ * Author: George Nikolaidis
+ *
+ * PIC12F615 core for the host build, see pic12f615_sim.h
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "pic12f615_sim.h"
+#include "ds18b20_sim.h"
+
+struct pic_sim sim;
+
+extern void sim_isr(void) __attribute__((weak));                               /* nmain.c, HAL_ISR() */
+extern unsigned char __start_fwram[] __attribute__((weak));                    /* nmain.c, HAL_RAM, set by the linker */
+extern unsigned char __stop_fwram[] __attribute__((weak));
+
+static void busUpdate(void);
+static void watchUpdate(void);
+
+static void registerReset(void){
+
+    memset(sim.sfr, 0, sizeof(sim.sfr));
+    sim.sfr[SFR_TRISA]          = 0x3F;                                         /* reset values, datasheet table 2-2 */
+    sim.sfr[SFR_ANSEL]          = 0x0F;
+    sim.sfr[SFR_OPTION_REG]     = 0xFF;
+    sim.sfr[SFR_PR2]            = 0xFF;
+    sim.sfr[SFR_WPU]            = 0x37;
+    sim.latch                   = 0;
+    sim.t0_count                = 0;
+    sim.t0_sub                  = 0;
+    sim.t0_inhibit              = 0;
+    sim.t1_count                = 0;
+    sim.t1_sub                  = 0;
+    sim.t2_phase                = 0;
+    sim.pwm_duty                = 0;
+    sim.int_level               = 0;
+    sim.wdt_count               = 0;
+
+}
+
+/* What XC8 startup code does on every reset: the firmware globals go back to
+ * what they were when the program was loaded, kept from the first call. */
+static void ramReset(void){
+
+    static unsigned char *image;
+    size_t size = (size_t)(__stop_fwram - __start_fwram);
+
+    if(!__start_fwram) return;                                                  /* no firmware in this build */
+    if(!image){
+        image = malloc(size);
+        if(image) memcpy(image, __start_fwram, size);
+    } else {
+        memcpy(__start_fwram, image, size);
+    }
+
+}
+
+void sim_reset(void){
+
+    memset(&sim, 0, sizeof(sim));
+    sim.stop_at                 = UINT64_MAX;
+    sim.wdte                    = 1;                                            /* as nmain.c, WDTE = ON */
+    registerReset();
+    ramReset();
+    sim_slot_stats_clear();
+
+}
+
+void sim_plant(sim_plant_fn fn, void *ctx){
+
+    sim.plant       = fn;
+    sim.plant_ctx   = ctx;
+    sim.plant_at    = fn ? sim.cycles : UINT64_MAX;
+
+}
+
+void sim_watch(sim_watch_fn fn, void *ctx){
+
+    sim.watch       = fn;
+    sim.watch_ctx   = ctx;
+    sim.watch_pins  = 0;
+    watchUpdate();
+
+}
+
+static void iocCheck(void);
+
+void sim_pin_set(int pin, int level){
+
+    if(level) sim.pin_in |= (uint8_t)(1u << pin);
+    else      sim.pin_in &= (uint8_t)~(1u << pin);
+    iocCheck();
+
+}
+
+void sim_attach(struct ds18b20_sim *dev){
+
+    if(sim.ndev < SIM_MAX_DEVICES){
+        sim.dev[sim.ndev++] = dev;
+    }
+
+}
+
+int sim_run(void (*entry)(void), uint64_t budget){
+
+    jmp_buf env;
+    jmp_buf *outer          = sim.exit;
+    uint64_t outerStop      = sim.stop_at;
+    volatile int expired    = 0;
+
+    sim.stop_at = (budget > UINT64_MAX - sim.cycles) ? UINT64_MAX : sim.cycles + budget;
+    sim.exit    = &env;
+    switch(setjmp(env)){
+        case 2:                                                                 /* watchdog reset, the startup code runs again */
+            sim.wdt_resets++;
+            sim.wdt_reset_at = sim.cycles;
+            registerReset();
+            ramReset();
+            busUpdate();
+            watchUpdate();
+            /* fall through */
+        case 0:
+            entry();                                                            /* returns on its own, or never (main) */
+            break;
+        default:
+            expired = 1;                                                        /* budget used up, longjmp from sim_advance */
+            break;
+    }
+    sim.exit    = outer;
+    sim.stop_at = outerStop;
+    return expired;
+
+}
+
+/* TIMER2 / CCP1 PWM */
+static uint32_t t2Prescale(void){
+
+    switch(sim.sfr[SFR_T2CON] & 0x3){
+        case 0:  return 1;
+        case 1:  return 4;
+        default: return 16;
+    }
+
+}
+
+static uint32_t t2Period(void){
+
+    return 4u * ((uint32_t)sim.sfr[SFR_PR2] + 1u) * t2Prescale();               /* (PR2 + 1) * 4 * Tosc * prescale */
+
+}
+
+static uint32_t ccp1Duty(void){
+
+    uint32_t dc = ((uint32_t)sim.sfr[SFR_CCPR1L] << 2) | ((sim.sfr[SFR_CCP1CON] >> 4) & 0x3);
+    return dc * t2Prescale();                                                   /* CCPR1L:DC1B * Tosc * prescale */
+
+}
+
+static int pwmActive(void){
+
+    return (sim.sfr[SFR_CCP1CON] & 0x0C) == 0x0C && !(sim.sfr[SFR_TRISA] & 0x04);
+
+}
+
+static int gp2Level(void){
+
+    if(pwmActive()){
+        return sim.t2_phase < sim.pwm_duty;
+    }
+    return !(sim.sfr[SFR_TRISA] & 0x04) && (sim.latch & 0x04);
+
+}
+
+/* GP2/INT
+ * The edge detector sees the pin whatever drives it, the PWM output too.
+ * INTF is set on the edge INTEDG picks, INTE or not. A PWM period with a
+ * duty between 0 and 100% has both edges, INTF is set at its start. */
+static void intEdge(void){
+
+    uint8_t level = (uint8_t)gp2Level();
+
+    if(level != sim.int_level){
+        sim.int_level = level;
+        if(level == ((sim.sfr[SFR_OPTION_REG] >> 6) & 0x1)){                   /* INTEDG, 1 rising */
+            sim.sfr[SFR_INTCON] |= 0x02;                                        /* INTF */
+        }
+    }
+
+}
+
+static void pwmAccount(uint32_t from, uint32_t to){
+
+    uint32_t high;
+
+    sim.pwm_total_tosc += to - from;
+    if(pwmActive()){
+        high = sim.pwm_duty < t2Period() ? sim.pwm_duty : t2Period();
+        if(from < high){
+            sim.pwm_high_tosc += (to < high ? to : high) - from;
+        }
+    } else if(gp2Level()){
+        sim.pwm_high_tosc += to - from;
+    }
+
+}
+
+static void t2Rollover(void){
+
+    sim.t2_phase        = 0;
+    sim.pwm_duty        = ccp1Duty();                                           /* duty is latched into CCPR1H at period start */
+    if(pwmActive() && sim_pwm_duty10() != sim.pwm_level){                       /* what the fan sees change */
+        sim.pwm_level       = sim_pwm_duty10();
+        sim.pwm_changes++;
+        sim.pwm_changed_at  = sim.cycles;
+    }
+    if(pwmActive() && sim.pwm_duty && sim.pwm_duty < t2Period()){
+        sim.sfr[SFR_INTCON] |= 0x02;                                            /* INTF, GP2 rose and will fall */
+    }
+    sim.int_level       = (uint8_t)gp2Level();
+    sim.sfr[SFR_PIR1]  |= 0x02;                                                 /* TMR2IF, postscaler 1:1 */
+
+}
+
+static void t2Advance(uint64_t tosc){
+
+    uint32_t period;
+    uint32_t left;
+    uint32_t step;
+    uint64_t whole;
+
+    if(!(sim.sfr[SFR_T2CON] & 0x04)){                                           /* Timer2 stopped, GP2 holds its level */
+        sim.pwm_total_tosc += tosc;
+        if(gp2Level()) sim.pwm_high_tosc += tosc;
+        return;
+    }
+    period = t2Period();
+    while(tosc){
+        if(sim.t2_phase >= period){
+            t2Rollover();
+        }
+        if(sim.t2_phase == 0 && tosc >= period){                                /* skip whole periods in one go, 2s delays are 50000 of them */
+            whole  = tosc / period;
+            step   = sim.pwm_duty < period ? sim.pwm_duty : period;
+            sim.pwm_total_tosc += whole * period;
+            if(pwmActive())     sim.pwm_high_tosc += whole * step;
+            else if(gp2Level()) sim.pwm_high_tosc += whole * period;
+            tosc  -= whole * period;
+            t2Rollover();
+            continue;
+        }
+        left = period - sim.t2_phase;
+        step = tosc < left ? (uint32_t)tosc : left;
+        pwmAccount(sim.t2_phase, sim.t2_phase + step);
+        sim.t2_phase += step;
+        tosc         -= step;
+    }
+
+}
+
+/* TIMER0
+ * Counts instruction cycles through the prescaler unless PSA gives that to
+ * the watchdog, then 1:1. T0CKI is not modelled, T0CS set stops it.
+ * A write clears the prescaler and holds the count for 2 cycles. */
+static uint32_t t0Prescale(void){
+
+    uint8_t option = sim.sfr[SFR_OPTION_REG];
+
+    return (option & 0x08) ? 1u : 2u << (option & 0x7);
+
+}
+
+static uint64_t t0ToOverflow(void){
+
+    if(sim.sfr[SFR_OPTION_REG] & 0x20) return UINT64_MAX;
+    return sim.t0_inhibit + (uint64_t)(0x100u - sim.t0_count) * t0Prescale() - sim.t0_sub;
+
+}
+
+static void t0Advance(uint64_t cycles){
+
+    uint64_t ticks;
+
+    if(sim.sfr[SFR_OPTION_REG] & 0x20) return;
+    if(sim.t0_inhibit){
+        if(cycles <= sim.t0_inhibit){
+            sim.t0_inhibit -= (uint32_t)cycles;
+            return;
+        }
+        cycles         -= sim.t0_inhibit;
+        sim.t0_inhibit  = 0;
+    }
+    ticks       = (sim.t0_sub + cycles) / t0Prescale();
+    sim.t0_sub  = (uint32_t)((sim.t0_sub + cycles) % t0Prescale());
+    if(sim.t0_count + ticks > 0xFF){
+        sim.sfr[SFR_INTCON] |= 0x04;                                            /* T0IF */
+    }
+    sim.t0_count = (uint32_t)((sim.t0_count + ticks) & 0xFF);
+
+}
+
+static uint64_t t0Left(void){
+
+    return (sim.sfr[SFR_INTCON] & 0x20) ? t0ToOverflow() : UINT64_MAX;         /* only an enabled overflow has to be on time */
+
+}
+
+/* TIMER1 */
+static uint32_t t1Prescale(void){
+
+    return 1u << ((sim.sfr[SFR_T1CON] >> 4) & 0x3);
+
+}
+
+static uint64_t t1ToOverflow(void){
+
+    if(!(sim.sfr[SFR_T1CON] & 0x01)) return UINT64_MAX;
+    return (uint64_t)(0x10000u - sim.t1_count) * t1Prescale() - sim.t1_sub;
+
+}
+
+static void t1Advance(uint64_t cycles){
+
+    uint64_t ticks;
+
+    if(!(sim.sfr[SFR_T1CON] & 0x01)) return;
+    ticks       = (sim.t1_sub + cycles) / t1Prescale();
+    sim.t1_sub  = (uint32_t)((sim.t1_sub + cycles) % t1Prescale());
+    if(sim.t1_count + ticks > 0xFFFF){
+        sim.sfr[SFR_PIR1] |= 0x01;                                              /* TMR1IF */
+    }
+    sim.t1_count = (uint32_t)((sim.t1_count + ticks) & 0xFFFF);
+
+}
+
+/* PLANT */
+static uint64_t plantLeft(void){
+
+    if(!sim.plant) return UINT64_MAX;
+    return sim.plant_at > sim.cycles ? sim.plant_at - sim.cycles : 0;
+
+}
+
+static void plantRun(void){
+
+    while(sim.plant && sim.cycles >= sim.plant_at){
+        sim.plant_at = sim.plant(sim.plant_ctx, sim.cycles);
+        if(sim.plant_at <= sim.cycles) sim.plant_at = sim.cycles + 1;
+    }
+
+}
+
+/* WATCHDOG */
+static uint64_t wdtPeriod(void){
+
+    uint8_t option = sim.sfr[SFR_OPTION_REG];
+
+    if(option & 0x08) return SIM_WDT_BASE << (option & 0x7);                    /* PSA, prescaler assigned to the WDT */
+    return SIM_WDT_BASE;
+
+}
+
+static uint64_t wdtLeft(void){
+
+    if(!sim.wdte) return UINT64_MAX;
+    return sim.wdt_count < wdtPeriod() ? wdtPeriod() - sim.wdt_count : 0;
+
+}
+
+void sim_clrwdt(void){
+
+    sim.wdt_count = 0;
+    sim_advance(1);
+
+}
+
+/* INTERRUPTS */
+static int interruptPending(void){
+
+    uint8_t  intcon = sim.sfr[SFR_INTCON];
+
+    if(!(intcon & 0x80) || !sim_isr) return 0;
+    return ((intcon >> 3) & intcon & 0x07) ||                                   /* T0IE/T0IF, INTE/INTF, GPIE/GPIF */
+           ((intcon & 0x40) && (sim.sfr[SFR_PIR1] & sim.sfr[SFR_PIE1]));
+
+}
+
+static void interruptCheck(void){
+
+    uint64_t start;
+    int      t0;
+
+    while(interruptPending()){                                                  /* a flag left set is taken again straight
+                                                                                 * after RETFIE, main() gets nothing */
+        start = sim.cycles;
+        t0    = (sim.sfr[SFR_INTCON] & 0x24) == 0x24;                           /* T0IE and T0IF */
+        sim.sfr[SFR_INTCON] &= (uint8_t)~0x80;                                  /* GIE cleared on entry */
+        sim.isr_count++;
+        sim_advance(SIM_ISR_ENTRY);
+        sim_isr();
+        sim_advance(SIM_ISR_EXIT);
+        sim.sfr[SFR_INTCON] |= 0x80;                                            /* RETFIE */
+        sim.isr_cycles += sim.cycles - start;
+        if(sim.cycles - start > sim.isr_max) sim.isr_max = sim.cycles - start;
+        if(t0){
+            sim.t0_isr_count++;
+            sim.t0_isr_cycles += sim.cycles - start;
+        }
+    }
+
+}
+
+/* TIME */
+void sim_advance(uint64_t cycles){
+
+    uint64_t step;
+
+    for(;;){
+        if(sim.cycles + cycles >= sim.stop_at){                                 /* an interrupt may have used up the rest */
+            cycles = sim.stop_at - sim.cycles;
+        }
+        if(!cycles) break;
+        step        = cycles < t1ToOverflow() ? cycles : t1ToOverflow();       /* stop at each Timer1 overflow */
+        if(step > t0Left()) step = t0Left();                                    /* and Timer0 with its interrupt on */
+        if(step > wdtLeft()) step = wdtLeft();
+        if(step > plantLeft()) step = plantLeft();                              /* and at each plant event */
+        sim.cycles += step;
+        cycles     -= step;
+        sim.wdt_count += step;
+        t2Advance(step * 4);
+        t0Advance(step);
+        t1Advance(step);
+        plantRun();
+        if(sim.wdte && sim.wdt_count >= wdtPeriod() && sim.exit){
+            longjmp(*sim.exit, 2);                                              /* watchdog timed out while awake */
+        }
+        interruptCheck();
+    }
+    if(sim.exit && sim.cycles >= sim.stop_at){
+        longjmp(*sim.exit, 1);
+    }
+
+}
+
+void sim_delay(unsigned long cycles){
+
+    if(sim.cycles + cycles > sim.stop_at) cycles = (unsigned long)(sim.stop_at - sim.cycles);
+    sim.delay_cycles += cycles;
+    sim_advance(cycles);
+
+}
+
+void sim_delay_ms(unsigned long cycles){
+
+    if(sim.cycles + cycles > sim.stop_at) cycles = (unsigned long)(sim.stop_at - sim.cycles);
+    sim.idle_cycles += cycles;
+    sim_delay(cycles);
+
+}
+
+void sim_cycles(unsigned cycles){
+
+    sim.code_cycles += cycles;
+    sim_advance(cycles);
+
+}
+
+void sim_nop(void){
+
+    sim.nop_cycles++;
+    sim_advance(1);
+
+}
+
+void sim_idle(void){
+                                                                                /* main() spinning until an interrupt sets a flag,
+                                                                                 * skip straight to the next timer overflow */
+    uint32_t isr = sim.isr_count;
+    uint64_t n;
+    int      plant;
+
+    do {
+        n       = t1ToOverflow() < t0Left() ? t1ToOverflow() : t0Left();
+        plant   = plantLeft() < n;
+        if(n == UINT64_MAX || n == 0 || interruptPending() || isr != sim.idle_isr){
+            n       = 1;                                                        /* flagged during the last interrupt, or one
+                                                                                 * came in after the last idle, a flag may be set */
+            plant   = 0;
+        } else if(plant){
+            n       = plantLeft();                                              /* an input may change, IOC */
+        }
+        sim.nop_cycles += n;
+        sim_advance(n);
+    } while(plant && sim.isr_count == isr);                                     /* only the plant moved, idle on */
+    sim.idle_isr = sim.isr_count;                                               /* taken since, main() looks at its flags first */
+
+}
+
+void sim_sleep(void){
+
+    uint64_t n = sim.wdte ? wdtPeriod() : UINT64_MAX;                           /* the watchdog wakes us up, */
+    uint64_t step;
+
+    if(n > sim.stop_at - sim.cycles) n = sim.stop_at - sim.cycles;
+    sim.sleeps++;
+    while(n && (sim.sfr[SFR_INTCON] & 0x09) != 0x09){                          /* or an enabled IOC, GPIE and GPIF */
+        step = n < plantLeft() ? n : plantLeft();
+        sim.pwm_total_tosc += step * 4;                                         /* Timer2 stopped, GP2 holds its level */
+        if(gp2Level()) sim.pwm_high_tosc += step * 4;
+        sim.cycles       += step;
+        sim.sleep_cycles += step;
+        n                -= step;
+        plantRun();
+    }
+    sim.wdt_count     = 0;
+    sim_advance(1);                                                             /* the instruction after SLEEP */
+
+}
+
+/* 1-WIRE BUS ON GP4 */
+int sim_bus_level(void){
+
+    if(sim.master_low) return 0;
+    for(int i=0;i<sim.ndev;i++){
+        if(ds18b20_sim_pulls_low(sim.dev[i], sim.cycles)) return 0;
+    }
+    return 1;                                                                   /* pull-up resistor */
+
+}
+
+void sim_bus_fault(int fault, uint32_t noisePpm){
+
+    sim.bus_fault       = fault;
+    sim.bus_noise_ppm   = noisePpm;
+    if(!sim.bus_rng) sim.bus_rng = 0x2545F491u;                                 /* repeatable */
+
+}
+
+static uint8_t busFault(uint8_t pins){
+                                                                                /* only what the PIC reads, not what the sensors see */
+    if(sim.bus_fault == SIM_BUS_OPEN)       pins |= 0x10;
+    else if(sim.bus_fault == SIM_BUS_SHORT) pins &= (uint8_t)~0x10;
+    if(sim.bus_noise_ppm){
+        sim.bus_rng ^= sim.bus_rng << 13;                                       /* xorshift32 */
+        sim.bus_rng ^= sim.bus_rng >> 17;
+        sim.bus_rng ^= sim.bus_rng << 5;
+        if(sim.bus_rng % 1000000u < sim.bus_noise_ppm){
+            pins ^= 0x10;
+            sim.bus_flips++;
+        }
+    }
+    return pins;
+
+}
+
+/* 1-WIRE SLOT TIMING
+ * Only from what the PIC does: its falling edges, its releases and its GP4
+ * bit reads. A low pulse is a reset from 240us on and a write 0 from 15us,
+ * a shorter one is a read slot if GP4 is read before the next falling edge,
+ * else a write 1. The first GP4 read after a reset is the presence sample.
+ * The windows are from the DS18B20 datasheet, the presence sample window is
+ * where the pulse is low for any sensor: 15-60us wait, at least 60us low.
+ */
+#define SLOT_IDLE               0
+#define SLOT_RESET              1                                               /* reset released, presence not sampled */
+#define SLOT_SHORT              2                                               /* short low, write 1 or read */
+#define SLOT_DONE               3                                               /* a slot, complete */
+
+const struct sim_slot_spec sim_slot_spec[SIM_SLOT_KINDS] = {
+    [SIM_SLOT_RESET]        = { "reset low",        480,   0 },
+    [SIM_SLOT_PRESENCE]     = { "presence sample",   60,  75 },
+    [SIM_SLOT_WRITE0]       = { "write 0 low",       60, 120 },
+    [SIM_SLOT_WRITE1]       = { "write 1 low",        1,  15 },
+    [SIM_SLOT_READ_LOW]     = { "read low",           1,  15 },
+    [SIM_SLOT_READ_SAMPLE]  = { "read sample",        1,  15 },
+    [SIM_SLOT_LENGTH]       = { "slot",              60,   0 },
+    [SIM_SLOT_RECOVERY]     = { "recovery",           1,   0 },
+};
+
+void sim_slot_stats_clear(void){
+
+    memset(sim.slot, 0, sizeof(sim.slot));
+    for(int i=0;i<SIM_SLOT_KINDS;i++){
+        sim.slot[i].min = UINT64_MAX;
+    }
+    sim.slot_state = SLOT_IDLE;
+
+}
+
+static void slotTime(enum sim_slot kind, uint64_t cycles){
+
+    struct sim_slot_stat *st = &sim.slot[kind];
+    uint64_t lo = SIM_US(sim_slot_spec[kind].min_us);
+    uint64_t hi = sim_slot_spec[kind].max_us ? SIM_US(sim_slot_spec[kind].max_us) : UINT64_MAX;
+    uint64_t off = 0;
+
+    st->count++;
+    if(cycles < st->min) st->min = cycles;
+    if(cycles > st->max) st->max = cycles;
+    if(cycles < lo)      off = lo - cycles;
+    else if(cycles > hi) off = cycles - hi;
+    if(off){
+        st->out++;
+        if(off > st->worst) st->worst = off;
+    }
+
+}
+
+static void slotEdge(uint8_t low){
+
+    if(low){
+        if(sim.slot_state == SLOT_SHORT){
+            slotTime(SIM_SLOT_WRITE1, sim.slot_rise - sim.slot_fall);           /* never sampled */
+        }
+        sim.slot_after = sim.slot_state == SLOT_SHORT || sim.slot_state == SLOT_DONE;
+        sim.slot_prev  = sim.slot_fall;
+        sim.slot_fall  = sim.cycles;
+        sim.slot_state = SLOT_IDLE;
+    } else {
+        uint64_t width = sim.cycles - sim.slot_fall;
+
+        if(width < SIM_US(240) && sim.slot_after){                              /* slot after slot, not the first after a reset */
+            slotTime(SIM_SLOT_LENGTH, sim.slot_fall - sim.slot_prev);
+            slotTime(SIM_SLOT_RECOVERY, sim.slot_fall - sim.slot_rise);         /* the release before this slot */
+        }
+        sim.slot_rise = sim.cycles;
+        if(width >= SIM_US(240)){
+            slotTime(SIM_SLOT_RESET, width);
+            sim.slot_state = SLOT_RESET;
+        } else if(width >= SIM_US(15)){
+            slotTime(SIM_SLOT_WRITE0, width);
+            sim.slot_state = SLOT_DONE;
+        } else {
+            sim.slot_state = SLOT_SHORT;
+        }
+    }
+
+}
+
+static void slotSample(void){
+
+    if(sim.master_low) return;
+    if(sim.slot_state == SLOT_RESET){
+        slotTime(SIM_SLOT_PRESENCE, sim.cycles - sim.slot_rise);
+        sim.slot_state = SLOT_IDLE;                                             /* the end of the window is read too */
+    } else if(sim.slot_state == SLOT_SHORT){
+        slotTime(SIM_SLOT_READ_LOW, sim.slot_rise - sim.slot_fall);
+        slotTime(SIM_SLOT_READ_SAMPLE, sim.cycles - sim.slot_fall);
+        sim.slot_state = SLOT_DONE;
+    }
+
+}
+
+static void busUpdate(void){
+
+    uint8_t low = !(sim.sfr[SFR_TRISA] & 0x10) && !(sim.latch & 0x10);
+
+    if(low != sim.master_low){
+        sim.master_low = low;
+        slotEdge(low);
+        for(int i=0;i<sim.ndev;i++){
+            ds18b20_sim_edge(sim.dev[i], low, sim.cycles);
+        }
+    }
+
+}
+
+/* OUTPUT WATCH */
+static void watchUpdate(void){
+
+    uint8_t pins = sim.latch & (uint8_t)~(sim.sfr[SFR_TRISA] | 0x08) & 0x3F;   /* what the PIC drives high */
+
+    if(sim.watch && pins != sim.watch_pins){
+        sim.watch_pins = pins;
+        sim.watch(sim.watch_ctx, pins, sim.cycles);
+    }
+
+}
+
+/* INTERRUPT ON CHANGE */
+static uint8_t gpioPins(void);
+
+static void iocCheck(void){
+
+    if((gpioPins() ^ sim.ioc_snap) & sim.sfr[SFR_IOC]){
+        sim.sfr[SFR_INTCON] |= 0x01;                                            /* GPIF */
+    }
+
+}
+
+/* REGISTERS */
+static uint8_t gpioPins(void){
+
+    uint8_t tris = sim.sfr[SFR_TRISA] | 0x08;                                   /* GP3 is input only */
+    uint8_t pins = (uint8_t)((sim.latch & ~tris) | (sim.pin_in & tris));
+
+    pins &= (uint8_t)~0x14;
+    if(sim_bus_level()) pins |= 0x10;
+    if(gp2Level())      pins |= 0x04;
+    return pins & 0x3F;
+
+}
+
+static uint8_t regRead(enum sim_sfr reg){
+
+    switch(reg){
+        case SFR_GPIO: return sim.ioc_snap = busFault(gpioPins());             /* a read ends the mismatch */
+        case SFR_TMR0: return (uint8_t)sim.t0_count;
+        case SFR_TMR1L: return (uint8_t)(sim.t1_count & 0xFF);
+        case SFR_TMR1H: return (uint8_t)(sim.t1_count >> 8);
+        case SFR_TMR2: return (uint8_t)(sim.t2_phase / (4u * t2Prescale()));
+        default:       return sim.sfr[reg];
+    }
+
+}
+
+static void regWrite(enum sim_sfr reg, uint8_t value){
+
+    switch(reg){
+        case SFR_GPIO:
+            sim.latch = value & 0x3F;
+            busUpdate();
+            watchUpdate();
+            break;
+        case SFR_TRISA:
+            sim.sfr[reg] = value | 0x08;
+            busUpdate();
+            watchUpdate();
+            break;
+        case SFR_TMR0:
+            sim.t0_count   = value;
+            sim.t0_sub     = 0;                                                 /* a write clears the prescaler */
+            sim.t0_inhibit = 2;                                                 /* and the count waits 2 cycles */
+            break;
+        case SFR_IOC:
+            sim.sfr[reg] = value & 0x3F;
+            iocCheck();
+            break;
+        case SFR_TMR1L:
+            sim.t1_count = (sim.t1_count & 0xFF00) | value;
+            sim.t1_sub   = 0;                                                   /* a write clears the prescaler */
+            break;
+        case SFR_TMR1H:
+            sim.t1_count = (sim.t1_count & 0x00FF) | ((uint32_t)value << 8);
+            sim.t1_sub   = 0;
+            break;
+        case SFR_TMR2:
+            sim.t2_phase = 4u * t2Prescale() * value;
+            break;
+        default:
+            sim.sfr[reg] = value;
+            break;
+    }
+    intEdge();                                                                  /* GPIO, TRISA, CCP1CON move GP2 too */
+
+}
+
+uint8_t sim_reg_read(enum sim_sfr reg){
+
+    uint8_t value = regRead(reg);
+    sim_advance(1);                                                             /* MOVF */
+    return value;
+
+}
+
+void sim_reg_write(enum sim_sfr reg, uint8_t value){
+
+    sim.sfr_writes[reg]++;
+    regWrite(reg, value);
+    sim_advance(1);                                                             /* MOVWF, CLRF */
+
+}
+
+uint8_t sim_bit_read(enum sim_sfr reg, enum sim_bit bit){
+
+    uint8_t value = (regRead(reg) >> bit) & 0x1;
+
+    if(reg == SFR_GPIO && bit == SIM_BIT_GP4) slotSample();                    /* MASTER_READ_BIT */
+    sim_advance(1);                                                             /* BTFSS, BTFSC */
+    return value;
+
+}
+
+void sim_bit_write(enum sim_sfr reg, enum sim_bit bit, uint8_t value){
+
+    uint8_t v = regRead(reg);                                                   /* BSF, BCF read the pins, not the latch */
+
+    if(value & 0x1) v |= (uint8_t)(1u << bit);
+    else            v &= (uint8_t)~(1u << bit);
+    sim.sfr_writes[reg]++;
+    regWrite(reg, v);
+    sim_advance(1);
+
+}
+
+/* PWM OBSERVATION */
+unsigned sim_pwm_duty10(void){
+
+    return ((unsigned)sim.sfr[SFR_CCPR1L] << 2) | ((sim.sfr[SFR_CCP1CON] >> 4) & 0x3);
+
+}
+
+unsigned sim_pwm_output_permille(void){
+                                                                                /* what GP2 drives now, averaged over a period */
+    if(pwmActive()){
+        if(sim.pwm_duty >= t2Period()) return 1000;
+        return (unsigned)(sim.pwm_duty * 1000u / t2Period());
+    }
+    return gp2Level() ? 1000 : 0;
+
+}
+
+void sim_pwm_stats_clear(void){
+
+    sim.pwm_high_tosc   = 0;
+    sim.pwm_total_tosc  = 0;
+
+}
+
+unsigned sim_pwm_average_permille(void){
+
+    if(sim.pwm_total_tosc == 0) return 0;
+    return (unsigned)(sim.pwm_high_tosc * 1000u / sim.pwm_total_tosc);
+
+}
@@ -0,0 +1,224 @@
+/*
+ * File:   pic12f615_sim.h
+ * Author: George Nikolaidis
+ *
+ * Host side PIC12F615 core used when nmain.c is built without XC8.
+ * Time is counted in instruction cycles, 8MHz / 4 = 500ns per cycle.
+ * Every SFR access made through hal.h costs one cycle, the __delay_us and
+ * __delay_ms macros cost exactly what they ask for, HAL_CYCLES() what the
+ * firmware estimates by hand the C in between costs. Nothing else of the C
+ * is counted, the cycles are a model and a bound from below.
+ * Modelled: GPIO with read-modify-write on the port, Timer0 and Timer1 with
+ * their overflow interrupts, Timer2 with the CCP1 PWM output on GP2, GP4 as an
+ * open drain 1-wire bus with a pull-up and up to SIM_MAX_DEVICES DS18B20
+ * stand-ins hanging on it.
+ * The firmware interrupt routine is sim_isr(), see HAL_ISR() in hal.h.
+ * The watchdog runs from its own 18ms oscillator through the OPTION_REG
+ * prescaler when PSA is 1. It wakes the core from SLEEP, and resets it
+ * when it runs out while awake: main() is then started again from the top,
+ * with the firmware globals as the XC8 startup code leaves them, see HAL_RAM.
+ * In SLEEP the 8MHz oscillator stops, and with it Timer0, Timer1, Timer2
+ * and PWM.
+ * Interrupt on change sets GPIF when an IOC pin differs from its level at
+ * the last GPIO read, and wakes the core from SLEEP when GPIE is set.
+ * GP2/INT sets INTF on the INTEDG edge, also from the CCP1 PWM output on
+ * the same pin, once per PWM period.
+ * GP4 can be made noisy, open or shorted as the PIC reads it, see
+ * sim_bus_fault(), the sensors still see what the PIC drives.
+ * Anything else outside the chip, the fan for one, is a plant: a callback
+ * the simulator calls at the times it asks for, that drives input pins.
+ * What listens to output pins, the telemetry UART on GP0, is a watch: a
+ * callback on every change of the levels the PIC drives.
+ * The 1-wire slots the PIC makes on GP4 are timed from its own edges and
+ * GP4 bit reads and held against the DS18B20 windows in sim_slot_spec[].
+ */
+
+#ifndef PIC12F615_SIM_H
+#define PIC12F615_SIM_H
+
+#include <stdint.h>
+#include <setjmp.h>
+
+#define SIM_NS_PER_CYCLE        500
+#define SIM_US(us)              ((uint64_t)(us) * 2)                            /* us to cycles */
+#define SIM_MS(ms)              ((uint64_t)(ms) * 2000)                         /* ms to cycles */
+#define SIM_MAX_DEVICES         8
+#define SIM_ISR_ENTRY           8                                               /* latency, GOTO, XC8 context save */
+#define SIM_ISR_EXIT            6                                               /* context restore, RETFIE */
+#define SIM_WDT_BASE            SIM_MS(18)                                      /* nominal watchdog period, prescaler 1:1 */
+#define SIM_IDD_ACTIVE_UA       1100                                            /* rough typical supply current at 5V, INTOSC 8MHz */
+#define SIM_IPD_WDT_UA          3                                               /* rough typical in SLEEP with the watchdog on */
+
+enum sim_sfr {
+    SFR_GPIO,
+    SFR_TRISA,
+    SFR_TMR0,
+    SFR_ANSEL,
+    SFR_OPTION_REG,
+    SFR_INTCON,
+    SFR_PIR1,
+    SFR_PIE1,
+    SFR_TMR1L,
+    SFR_TMR1H,
+    SFR_T1CON,
+    SFR_TMR2,
+    SFR_PR2,
+    SFR_T2CON,
+    SFR_CCPR1L,
+    SFR_CCP1CON,
+    SFR_WPU,
+    SFR_IOC,
+    SFR_COUNT
+};
+
+enum sim_bit {
+    SIM_BIT_GP0     = 0, SIM_BIT_GP1     = 1, SIM_BIT_GP2     = 2,
+    SIM_BIT_GP3     = 3, SIM_BIT_GP4     = 4, SIM_BIT_GP5     = 5,
+    SIM_BIT_TRISIO0 = 0, SIM_BIT_TRISIO1 = 1, SIM_BIT_TRISIO2 = 2,
+    SIM_BIT_TRISIO3 = 3, SIM_BIT_TRISIO4 = 4, SIM_BIT_TRISIO5 = 5,
+    SIM_BIT_GPIF    = 0, SIM_BIT_INTF    = 1, SIM_BIT_T0IF    = 2,
+    SIM_BIT_GPIE    = 3, SIM_BIT_INTE    = 4, SIM_BIT_T0IE    = 5,
+    SIM_BIT_PEIE    = 6, SIM_BIT_GIE     = 7,
+    SIM_BIT_TMR1IF  = 0, SIM_BIT_TMR2IF  = 1, SIM_BIT_CCP1IF  = 5,
+    SIM_BIT_TMR1IE  = 0, SIM_BIT_TMR2IE  = 1, SIM_BIT_CCP1IE  = 5,
+    SIM_BIT_T2ON    = 2, SIM_BIT_TMR1ON  = 0
+};
+
+enum sim_bus {
+    SIM_BUS_OK,
+    SIM_BUS_OPEN,                                                               /* GP4 reads high, nothing answers */
+    SIM_BUS_SHORT                                                               /* GP4 reads low */
+};
+
+enum sim_slot {
+    SIM_SLOT_RESET,                                                             /* reset low */
+    SIM_SLOT_PRESENCE,                                                          /* release to the presence sample */
+    SIM_SLOT_WRITE0,                                                            /* write 0 low */
+    SIM_SLOT_WRITE1,                                                            /* write 1 low */
+    SIM_SLOT_READ_LOW,                                                          /* read slot low */
+    SIM_SLOT_READ_SAMPLE,                                                       /* read slot falling edge to the sample */
+    SIM_SLOT_LENGTH,                                                            /* falling edge to the next, slot after slot */
+    SIM_SLOT_RECOVERY,                                                          /* release to the next slot */
+    SIM_SLOT_KINDS
+};
+
+struct sim_slot_spec {
+    const char *name;
+    uint32_t min_us;
+    uint32_t max_us;                                                            /* 0 no upper limit */
+};
+
+struct sim_slot_stat {
+    uint32_t count;
+    uint32_t out;                                                               /* outside the window */
+    uint64_t min;                                                               /* cycles */
+    uint64_t max;
+    uint64_t worst;                                                             /* furthest outside, cycles */
+};
+
+struct ds18b20_sim;
+
+typedef uint64_t (*sim_plant_fn)(void *ctx, uint64_t cycles);                  /* returns when to be called next */
+typedef void (*sim_watch_fn)(void *ctx, uint8_t pins, uint64_t cycles);         /* driven output levels, on a change */
+
+struct pic_sim {
+    uint64_t cycles;                                                            /* instruction cycles since power on */
+    uint64_t stop_at;                                                           /* sim_run() budget */
+    uint64_t delay_cycles;                                                      /* cycles spent in __delay_us/__delay_ms */
+    uint64_t idle_cycles;                                                       /* of those, spent in __delay_ms */
+    uint64_t code_cycles;                                                       /* charged by HAL_CYCLES() */
+    uint8_t  sfr[SFR_COUNT];
+    uint32_t sfr_writes[SFR_COUNT];                                             /* by the firmware */
+    uint8_t  latch;                                                             /* GPIO output latch */
+    uint8_t  pin_in;                                                            /* levels applied from outside on input pins */
+    uint8_t  ioc_snap;                                                          /* pins at the last GPIO read, for IOC */
+    uint8_t  int_level;                                                         /* GP2 as the INT edge detector saw it last */
+
+    uint32_t t0_count;                                                          /* TMR0 */
+    uint32_t t0_sub;                                                            /* prescaler */
+    uint32_t t0_inhibit;                                                        /* cycles a TMR0 write holds the count */
+
+    uint32_t t1_count;                                                          /* TMR1H:TMR1L */
+    uint32_t t1_sub;                                                            /* prescaler */
+
+    uint32_t t2_phase;                                                          /* Tosc into the current PWM period */
+    uint32_t pwm_duty;                                                          /* duty latched at period start, Tosc */
+    uint64_t pwm_high_tosc;                                                     /* GP2 high time */
+    uint64_t pwm_total_tosc;
+    uint32_t pwm_level;                                                         /* CCPR1L:DC1B latched last, 10 bit */
+    uint32_t pwm_changes;                                                       /* periods that started with a new duty */
+    uint64_t pwm_changed_at;
+
+    uint32_t isr_count;
+    uint64_t isr_cycles;                                                        /* cycles spent in the interrupt routine */
+    uint64_t isr_max;                                                           /* the longest single one */
+    uint32_t t0_isr_count;                                                      /* the ones taken for T0IF */
+    uint64_t t0_isr_cycles;
+    uint64_t nop_cycles;                                                        /* cycles main() gave away in HAL_NOP(), HAL_IDLE() */
+    uint32_t idle_isr;                                                          /* isr_count when HAL_IDLE() last returned */
+
+    uint8_t  wdte;                                                              /* #pragma config WDTE */
+    uint64_t wdt_count;                                                         /* cycles since CLRWDT/SLEEP */
+    uint64_t sleep_cycles;
+    uint32_t sleeps;
+    uint32_t wdt_resets;
+    uint64_t wdt_reset_at;                                                      /* cycles at the last watchdog reset */
+
+    sim_plant_fn plant;
+    void    *plant_ctx;
+    uint64_t plant_at;
+
+    sim_watch_fn watch;
+    void    *watch_ctx;
+    uint8_t  watch_pins;                                                        /* driven levels last reported */
+
+    uint8_t  master_low;                                                        /* PIC pulls GP4 low */
+    uint8_t  slot_state;                                                        /* what the last low pulse was */
+    uint64_t slot_fall;                                                         /* when GP4 was pulled low */
+    uint64_t slot_rise;                                                         /* and released */
+    uint64_t slot_prev;                                                         /* the falling edge before that */
+    uint8_t  slot_after;                                                        /* the low pulse follows a slot */
+    struct sim_slot_stat slot[SIM_SLOT_KINDS];
+    int      bus_fault;                                                         /* SIM_BUS_OK, SIM_BUS_OPEN, SIM_BUS_SHORT */
+    uint32_t bus_noise_ppm;                                                     /* chance a GPIO read sees GP4 flipped */
+    uint32_t bus_rng;
+    uint32_t bus_flips;
+    int      ndev;
+    struct ds18b20_sim *dev[SIM_MAX_DEVICES];
+
+    jmp_buf *exit;
+};
+
+extern struct pic_sim sim;
+extern const struct sim_slot_spec sim_slot_spec[SIM_SLOT_KINDS];
+
+void     sim_reset(void);
+void     sim_attach(struct ds18b20_sim *dev);
+void     sim_plant(sim_plant_fn fn, void *ctx);
+void     sim_watch(sim_watch_fn fn, void *ctx);
+void     sim_pin_set(int pin, int level);
+int      sim_run(void (*entry)(void), uint64_t budget);
+
+void     sim_advance(uint64_t cycles);
+void     sim_delay(unsigned long cycles);
+void     sim_delay_ms(unsigned long cycles);
+void     sim_nop(void);
+void     sim_idle(void);
+void     sim_sleep(void);
+void     sim_clrwdt(void);
+void     sim_cycles(unsigned cycles);
+
+uint8_t  sim_reg_read(enum sim_sfr reg);
+void     sim_reg_write(enum sim_sfr reg, uint8_t value);
+uint8_t  sim_bit_read(enum sim_sfr reg, enum sim_bit bit);
+void     sim_bit_write(enum sim_sfr reg, enum sim_bit bit, uint8_t value);
+
+int      sim_bus_level(void);
+void     sim_bus_fault(int fault, uint32_t noisePpm);
+unsigned sim_pwm_duty10(void);
+unsigned sim_pwm_output_permille(void);
+void     sim_pwm_stats_clear(void);
+void     sim_slot_stats_clear(void);
+unsigned sim_pwm_average_permille(void);
+
+#endif
@@ -0,0 +1,87 @@
+/*
+ * File:   profile_sim.c
+ * Author: George Nikolaidis
+ *
+ * Per function cycle profile, see profile_sim.h
+ */
+
+#include <string.h>
+#include "pic12f615_sim.h"
+#include "profile_sim.h"
+
+struct profile_sim sim_profile;
+
+struct profile_function *profile_sim_find(const char *name){
+
+    for(int i=0;i<sim_profile.n;i++){
+        if(!strcmp(sim_profile.fn[i].name, name)) return &sim_profile.fn[i];
+    }
+    return NULL;
+
+}
+
+static int lookup(int *id, const char *name){
+
+    struct profile_function *fn;
+
+    if(*id >= 0) return *id;                                                    /* each hook remembers its slot */
+    fn = profile_sim_find(name);
+    if(!fn){
+        if(sim_profile.n == PROFILE_MAX_FUNCTIONS) return -1;
+        fn = &sim_profile.fn[sim_profile.n++];
+        memset(fn, 0, sizeof(*fn));
+        fn->name = name;
+        fn->min  = UINT64_MAX;
+    }
+    *id = (int)(fn - sim_profile.fn);
+    return *id;
+
+}
+
+void profile_sim_enter(int *id, const char *name){
+
+    if(lookup(id, name) < 0 || sim_profile.depth == PROFILE_MAX_DEPTH) return;
+    sim_profile.stack[sim_profile.depth].id     = *id;
+    sim_profile.stack[sim_profile.depth].cycles = sim.cycles;
+    sim_profile.stack[sim_profile.depth].isr    = sim.isr_cycles;                       /* only moves once an interrupt is over */
+    sim_profile.depth++;
+
+}
+
+void profile_sim_exit(int *id, const char *name){
+
+    struct profile_function *fn;
+    uint64_t cycles;
+    int k = 0;
+
+    if(lookup(id, name) < 0) return;
+    while(sim_profile.depth && sim_profile.stack[sim_profile.depth - 1].id != *id){
+        sim_profile.depth--;                                                        /* left by a longjmp */
+        sim_profile.dropped++;
+    }
+    if(!sim_profile.depth) return;
+    sim_profile.depth--;
+    fn      = &sim_profile.fn[*id];
+    cycles  = sim.cycles - sim_profile.stack[sim_profile.depth].cycles;
+    fn->calls++;
+    fn->cycles += cycles;
+    fn->isr    += sim.isr_cycles - sim_profile.stack[sim_profile.depth].isr;
+    if(cycles < fn->min) fn->min = cycles;
+    if(cycles > fn->max) fn->max = cycles;
+    while(k < PROFILE_BUCKETS - 1 && (cycles >> k)) k++;
+    fn->bucket[k]++;
+
+}
+
+void profile_sim_clear(void){
+
+    for(int i=0;i<sim_profile.n;i++){
+        const char *name = sim_profile.fn[i].name;                                  /* the hooks keep their slots */
+        memset(&sim_profile.fn[i], 0, sizeof(sim_profile.fn[i]));
+        sim_profile.fn[i].name = name;
+        sim_profile.fn[i].min  = UINT64_MAX;
+    }
+    sim_profile.depth   = 0;
+    sim_profile.dropped = 0;
+
+}
@@ -0,0 +1,52 @@
+/*
+ * File:   profile_sim.h
+ * Author: George Nikolaidis
+ *
+ * Per function cycle profile for nmain.c on the simulator, the other end of
+ * HAL_PROFILE_ENTER() and HAL_PROFILE_EXIT() in hal.h when built with
+ * -DPROFILE=1. A hook costs the firmware no cycles, it only looks at the
+ * cycle counter. Every call goes into a histogram per function with a
+ * bucket per power of 2, the cycles spent in interrupts that came in
+ * between are kept apart. A frame left open by a watchdog reset or the end
+ * of sim_run() is dropped at the next exit below it.
+ */
+
+#ifndef PROFILE_SIM_H
+#define PROFILE_SIM_H
+
+#include <stdint.h>
+
+#define PROFILE_MAX_FUNCTIONS   32
+#define PROFILE_MAX_DEPTH       16
+#define PROFILE_BUCKETS         24                                              /* up to 2^23 cycles, 4.2s */
+
+struct profile_function {
+    const char *name;
+    uint32_t calls;
+    uint64_t cycles;                                                            /* enter to exit, interrupts and all */
+    uint64_t isr;                                                               /* of those, in interrupts */
+    uint64_t min;
+    uint64_t max;
+    uint32_t bucket[PROFILE_BUCKETS];                                           /* calls of 2^(k-1) to 2^k - 1 cycles */
+};
+
+struct profile_sim {
+    int      n;
+    struct profile_function fn[PROFILE_MAX_FUNCTIONS];
+    int      depth;
+    struct {
+        int      id;
+        uint64_t cycles;
+        uint64_t isr;
+    } stack[PROFILE_MAX_DEPTH];
+    uint32_t dropped;                                                           /* frames never exited */
+};
+
+extern struct profile_sim sim_profile;
+
+void profile_sim_enter(int *id, const char *name);
+void profile_sim_exit(int *id, const char *name);
+void profile_sim_clear(void);
+struct profile_function *profile_sim_find(const char *name);
+
+#endif
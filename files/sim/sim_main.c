@@ -0,0 +1,1077 @@
+/*
+ * File:   sim_main.c
+ * Author: George Nikolaidis
+ *
+ * Runs nmain.c on the PIC12F615 simulator and prints the cycles taken by
+ * SYSTEM_Initialize(), each 1-wire transaction and the main() loop.
+ * For the transactions it also prints how many of those cycles were spent
+ * in the interrupt and how many main() had free. The blocking 1-wire code
+ * kept the CPU for the whole duration of a transaction.
+ * After the main() run it splits the time into busy, idle (waiting for an
+ * interrupt) and asleep, and estimates the average supply current from it.
+ * The firmware before SLEEP was awake, at full current, all the time.
+ *
+ * A fan with a tach hangs on GP2/GP1 all the time, turning at FAN_RPM_MAX
+ * at 100%.
+ *
+ * A serial receiver listens to the telemetry on GP0 all the time, the run
+ * ends with the frames it got and what they cost in Timer0 interrupts, not
+ * with -DTELEMETRY=0.
+ *
+ * usage: fanctl-sim [-s seconds] [-p time:celsius,...] [-n sensors] [-u file] [-b] [-t] [-r trace] [-f] [-c] [-w] [-q]
+ *                   [-m] [-F boards [-j workers] [-P name=t0:d0,t1:d1,t2:d2,t3:d3]...]
+ *   -s  how long to run main() for, default 30 seconds
+ *   -p  temperature script, linear between points, default 25C constant
+ *   -n  sensors on the bus, default 1, sensor n reads the script + 2n C,
+ *       more than 1 with -DDS18B20_MAX_SENSORS=2 and up
+ *   -u  write the telemetry bytes from GP0 to a file, a fifo or a pty, for
+ *       fanctl-telemetry in files/host, not with -DTELEMETRY=0
+ *   -b  bus time per sample for 1 to SIM_MAX_DEVICES sensors, 1 without
+ *       a ROM table, then exit with 1 if the search missed a sensor or a
+ *       ROM code
+ *   -t  thermal transient, a 30C to 50C ramp and back, then exit. Build once
+ *       as is and once with -DSAMPLING_ADAPTIVE=0 to compare with the fixed
+ *       2.3s 9 bit sampling
+ *   -r  replay a temperature trace, a file of "seconds celsius" lines or
+ *       "hunt" for a built in one, then exit
+ *   -f  fan speed control, a 30C to 45C step with a slower fan than the
+ *       curve expects, then a stalled rotor, then exit. Build with
+ *       -DFAN_TACH=0 for the open loop
+ *   -c  cost of the scratchpad CRC as HAL_CYCLES() estimates it by hand
+ *       counts, then a run on a noisy, open and shorted
+ *       bus, then exit with 1 if a wrong reading got through or the curve
+ *       moved on a clean bus. Build with -DOW_CRC=2 for the nibble table, 0
+ *       for no check, which never fails
+ *   -w  a shorted bus, a missing sensor, a sensor lost mid-byte, none at
+ *       boot and a stalled 1-wire engine, checks how soon the fan is at the
+ *       fail-safe duty or the watchdog resets, then exit with 1 if too late
+ *   -q  do not print a line per loop
+ * Without any of -b -t -r -f -c -w -m -F it runs main() and exits with 1 if
+ * the watchdog reset the pic, an interrupt flag left set for one.
+ *   -m  two sensors, one without a ROM table, through a minute of rising
+ *       and falling temperature, prints the modelled cycles per call of the
+ *       functions nmain.c marks with HAL_PROFILE_ENTER() as a histogram and
+ *       the 1-wire slot times against the DS18B20 windows, then exits with 1
+ *       on a slot outside its window. Build with -DPROFILE=1
+ *   -F  that many boards in rack slots of their own, FLEET_SECONDS each or
+ *       -s, per fan curve: the one built in and two more, or those given
+ *       with -P. Prints the fan energy, peak temperature, duty changes and
+ *       time to setpoint per curve and the simulated seconds per second,
+ *       see fleet_sim.h. -j workers, default one per core
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pic12f615_sim.h"
+#include "ds18b20_sim.h"
+#include "fan_sim.h"
+#include "uart_sim.h"
+#include "fleet_sim.h"
+#include "profile_sim.h"
+#include "../fan_curve.h"
+#include "../telemetry.h"
+
+#define MAX_POINTS      4096                                                    /* recorded traces too */
+#define MAX_MOVES       1024
+
+#ifndef SAMPLING_ADAPTIVE
+#define SAMPLING_ADAPTIVE   1                                                   /* as nmain.c */
+#endif
+#ifndef TEMP_EMA_SHIFT
+#define TEMP_EMA_SHIFT      2
+#endif
+#ifndef FAN_TACH
+#define FAN_TACH            1
+#endif
+#ifndef OW_CRC
+#define OW_CRC              1
+#endif
+#ifndef DS18B20_MAX_SENSORS
+#define DS18B20_MAX_SENSORS 1
+#endif
+#if DS18B20_MAX_SENSORS > 1
+#define SIM_SENSORS         SIM_MAX_DEVICES                                     /* more than the build takes, it finds the first */
+#else
+#define SIM_SENSORS         1                                                   /* SKIP ROM, a second sensor would talk over it */
+#endif
+#define FAN_TAU_MS          1500                                                /* a 120mm fan from rest to 63% */
+
+                                                                                /* nmain.c */
+void firmware_main(void);
+void SYSTEM_Initialize(void);
+void owWait(void);
+void startConversion(void);
+void waitForConversion(void);
+void readTemperatures(void);
+void resolutionCheck(unsigned char res);
+void temperatureCompare(void);
+extern int tempFilter;
+#if DS18B20_MAX_SENSORS > 1
+extern unsigned char romTable[];
+extern unsigned char sensorCount;
+#endif
+extern unsigned char tempLSB, tempMSB;
+extern unsigned char pwmSelect;
+extern unsigned char readErrors;
+extern volatile unsigned char owQueuePos;                                      /* 0, OW_SCRIPT_IDLE, between queues */
+extern unsigned char fanCurveCcpr1l[], fanCurveCcp1con[];                      /* HAL_ROM, writable on the host */
+
+struct profile {
+    int      n;
+    uint64_t at[MAX_POINTS];                                                    /* cycles */
+    int16_t  temp[MAX_POINTS];                                                  /* 1/16 C */
+};
+
+struct probe {
+    const struct profile *profile;
+    int16_t  offset;                                                            /* 1/16 C */
+};
+
+static struct profile profile = {1, {0}, {25 * 16}};
+static struct ds18b20_sim sensor[SIM_MAX_DEVICES];
+static struct probe probe[SIM_MAX_DEVICES];
+static struct fan_sim fan;
+static struct uart_sim uart;
+static FILE *telemetryOut;
+static uint8_t telemetryWindow[TELEMETRY_FRAME];                                /* the last bytes from GP0 */
+static int telemetryFill;
+static uint32_t telemetryFrames;
+static void (*fanWatch)(uint64_t now);
+static int sensors = 1;
+static int quiet;
+static uint64_t lastConvert;
+static uint64_t lastIdle;
+static uint64_t lastSleep;
+static uint64_t loops;
+static uint64_t loopMin = UINT64_MAX, loopMax, loopWork;
+
+static int16_t profileTemp(uint64_t now, const struct profile *p){
+
+    int i;
+
+    if(now <= p->at[0]) return p->temp[0];
+    for(i=1;i<p->n;i++){
+        if(now < p->at[i]){
+            return (int16_t)(p->temp[i-1] + (int64_t)(p->temp[i] - p->temp[i-1]) *
+                   (int64_t)(now - p->at[i-1]) / (int64_t)(p->at[i] - p->at[i-1]));
+        }
+    }
+    return p->temp[p->n - 1];
+
+}
+
+static int16_t probeTemp(uint64_t now, void *ctx){
+
+    const struct probe *probe = ctx;
+
+    return (int16_t)(profileTemp(now, probe->profile) + probe->offset);
+
+}
+
+static int parseProfile(const char *arg){
+
+    char *end;
+
+    profile.n = 0;
+    while(*arg && profile.n < MAX_POINTS){
+        double t = strtod(arg, &end);
+        if(*end != ':') return -1;
+        double c = strtod(end + 1, &end);
+        if(profile.n && (uint64_t)(t * 2000000.0) < profile.at[profile.n - 1]) return -1;
+        profile.at[profile.n]   = (uint64_t)(t * 2000000.0);
+        profile.temp[profile.n] = (int16_t)(c * 16.0);
+        profile.n++;
+        if(*end == ',') end++;
+        else if(*end) return -1;
+        arg = end;
+    }
+    return profile.n ? 0 : -1;
+
+}
+
+static int loadTrace(const char *path){
+
+    FILE *f = fopen(path, "r");
+    char line[128];
+    double t, c;
+
+    if(!f) return -1;
+    profile.n = 0;
+    while(fgets(line, sizeof(line), f) && profile.n < MAX_POINTS){
+        if(line[0] == '#' || sscanf(line, "%lf%*[ ,;\t]%lf", &t, &c) != 2) continue;
+        profile.at[profile.n]   = (uint64_t)(t * 2000000.0);
+        profile.temp[profile.n] = (int16_t)(c * 16.0);
+        if(profile.n && profile.at[profile.n] < profile.at[profile.n - 1]) break;
+        profile.n++;
+    }
+    fclose(f);
+    return profile.n ? 0 : -1;
+
+}
+
+static void huntTrace(void){
+                                                                                /* 2 minutes either side of 35.0C with some noise,
+                                                                                 * a 10s ramp to 45C, a minute there, down to 33C */
+    uint32_t noise = 1;
+    int n = 0;
+
+    for(int i=0;i<80;i++){
+        noise = noise * 1103515245u + 12345u;
+        profile.at[n]   = (uint64_t)i * SIM_MS(1500);
+        profile.temp[n] = (int16_t)(((i & 1) ? 35 * 16 + 3 : 35 * 16 - 4) + (int)((noise >> 16) % 5) - 2);
+        n++;
+    }
+    profile.at[n] = SIM_MS(120000); profile.temp[n++] = 35 * 16;
+    profile.at[n] = SIM_MS(130000); profile.temp[n++] = 45 * 16;
+    profile.at[n] = SIM_MS(190000); profile.temp[n++] = 45 * 16;
+    profile.at[n] = SIM_MS(200000); profile.temp[n++] = 33 * 16;
+    profile.at[n] = SIM_MS(240000); profile.temp[n++] = 33 * 16;
+    profile.n = n;
+
+}
+
+static void telemetryByte(void *ctx, uint8_t byte, uint64_t now){
+
+    uint8_t sum = 0;
+
+    (void)ctx;
+    (void)now;
+    if(telemetryOut) fputc(byte, telemetryOut);
+    if(telemetryFill == TELEMETRY_FRAME){
+        memmove(telemetryWindow, telemetryWindow + 1, TELEMETRY_FRAME - 1);     /* slide on until a frame lines up */
+        telemetryFill--;
+    }
+    telemetryWindow[telemetryFill++] = byte;
+    if(telemetryFill < TELEMETRY_FRAME || telemetryWindow[0] != TELEMETRY_SYNC) return;
+    for(int i=0;i<TELEMETRY_FRAME;i++) sum += telemetryWindow[i];
+    if(sum) return;
+    telemetryFrames++;
+    telemetryFill = 0;
+    if(telemetryOut) fflush(telemetryOut);                                      /* a whole frame for whoever reads the other end */
+
+}
+
+static void onConvert(struct ds18b20_sim *dev, uint64_t now){
+
+    uint64_t period;
+    uint64_t work;
+
+    (void)dev;
+    if(lastConvert){                                                            /* one CONVERT T per main() loop */
+        period  = now - lastConvert;
+        work    = period - (sim.nop_cycles - lastIdle) - (sim.sleep_cycles - lastSleep);
+        loops++;
+        loopWork += work;
+        if(period < loopMin) loopMin = period;
+        if(period > loopMax) loopMax = period;
+        if(!quiet){
+            printf("  %8.3fs  temp %5.1fC  converted %3d  duty %3u/%u  period %9llu  work %7llu\n",
+                   now / 2000000.0, profileTemp(now, &profile) / 16.0, tempFilter >> TEMP_EMA_SHIFT >> 4,
+                   sim_pwm_duty10(), 4u * (sim.sfr[SFR_PR2] + 1u), (unsigned long long)period, (unsigned long long)work);
+        }
+    }
+    lastConvert = now;
+    lastIdle    = sim.nop_cycles;
+    lastSleep   = sim.sleep_cycles;
+
+}
+
+/* What the temperature side asks for, the duty of the curve step. Open loop
+ * that is the PWM duty itself, latched at the start of a PWM period. With
+ * the tach fanControl() starts from it and then moves the duty with the fan
+ * speed, so the step is taken when pwmSelect changes, seen within a
+ * FAN_SIM_STEP. */
+#if FAN_TACH
+static unsigned curveLevel;
+static uint64_t curveChangedAt;
+static uint32_t curveChanges;
+#define CURVE_LEVEL         curveLevel
+#define CURVE_CHANGED_AT    curveChangedAt
+#define CURVE_CHANGES       curveChanges
+#else
+#define CURVE_LEVEL         sim.pwm_level
+#define CURVE_CHANGED_AT    sim.pwm_changed_at
+#define CURVE_CHANGES       sim.pwm_changes
+#endif
+
+static uint64_t fanPlant(void *ctx, uint64_t now){
+
+    uint64_t next = fan_sim_step(ctx, now);
+#if FAN_TACH
+    unsigned duty = ((unsigned)fanCurveCcpr1l[pwmSelect] << 2) | ((fanCurveCcp1con[pwmSelect] >> 4) & 0x3);
+
+    if(duty != curveLevel){
+        curveLevel      = duty;
+        curveChangedAt  = now;
+        curveChanges++;
+    }
+#endif
+    if(fanWatch) fanWatch(now);
+    return next;
+
+}
+
+static void boot(int n){
+
+    uint8_t rom[7] = {0x28, 0, 0, 0, 0, 0, 0};
+    uint32_t serial = 0x1D3931;
+
+    sim_reset();
+#if FAN_TACH
+    curveLevel      = FAN_DUTY10(FAN_CURVE_T0);                                 /* the boot step, not a change */
+    curveChanges    = 0;
+#endif
+    fan_sim_init(&fan, FAN_RPM_MAX, FAN_TAU_MS, SIM_BIT_GP1);
+    sim_plant(fanPlant, &fan);
+    uart_sim_init(&uart, SIM_BIT_GP0, TELEMETRY_BAUD, telemetryByte, NULL);
+    sim_watch(uart_sim_watch, &uart);
+    telemetryFill   = 0;
+    telemetryFrames = 0;
+    for(int i=0;i<n;i++){
+        serial  = serial * 1103515245u + 12345u;                                /* distinct, repeatable serial numbers */
+        rom[1]  = (uint8_t)serial;
+        rom[2]  = (uint8_t)(serial >> 8);
+        rom[3]  = (uint8_t)(serial >> 16);
+        rom[4]  = (uint8_t)i;
+        probe[i].profile = &profile;
+        probe[i].offset  = (int16_t)(i * 2 * 16);
+        ds18b20_sim_init(&sensor[i], rom, probeTemp, &probe[i]);
+        sim_attach(&sensor[i]);
+    }
+
+}
+
+/* Sensors whose serial number the search found, and all it found. Without a ROM
+ * table the one sensor counts as found once its scratchpad reads. */
+#if DS18B20_MAX_SENSORS > 1
+static int enumerated(int n){
+
+    int found = 0;
+
+    for(int i=0;i<n;i++){
+        for(int j=0;j<sensorCount;j++){
+            if(!memcmp(&sensor[i].rom[1], &romTable[j * 6], 6)) found++;      /* the serial number, all the table keeps */
+        }
+    }
+    return found;
+
+}
+
+static int sensorsFound(void)   { return sensorCount; }
+#else
+static int enumerated(int n)    { return n == 1 && readErrors == 0; }
+static int sensorsFound(void)   { return enumerated(1); }
+#endif
+
+static void measure(const char *name, void (*fn)(void)){
+
+    uint64_t start  = sim.cycles;
+    uint64_t isr    = sim.isr_cycles;
+    uint64_t nop    = sim.nop_cycles;
+    uint64_t total;
+
+    sim_run(fn, SIM_MS(10000));
+    total = sim.cycles - start;
+    printf("  %-24s %8llu cycles %9.1f us  interrupt %7llu  free %7llu (%4.1f%%)\n", name,
+           (unsigned long long)total, total * SIM_NS_PER_CYCLE / 1000.0,
+           (unsigned long long)(sim.isr_cycles - isr), (unsigned long long)(sim.nop_cycles - nop),
+           total ? 100.0 * (sim.nop_cycles - nop) / total : 0.0);
+
+}
+
+static void doConversion(void)  { startConversion(); waitForConversion(); }
+static void doRead(void)        { readTemperatures(); }
+static void doSample(void)      { startConversion(); waitForConversion(); readTemperatures(); }
+
+/* Every sensor up to DS18B20_MAX_SENSORS has to be found with its ROM code
+ * and no other, or the sweep fails. */
+static int busSweep(void){
+
+    uint64_t start;
+    int expect;
+    int fail = 0;
+
+    printf("time per sample, CONVERT T to all sensors, the conversion time, then MATCH ROM reads\n");
+    for(int n=1;n<=SIM_SENSORS;n++){
+        boot(n);
+        sim_run(SYSTEM_Initialize, SIM_MS(10000));
+        start = sim.cycles;
+        sim_run(doSample, SIM_MS(10000));
+        expect = n < DS18B20_MAX_SENSORS ? n : DS18B20_MAX_SENSORS;
+        printf("  sensors %d  enumerated %d/%d  sample %7llu cycles %7.2f ms%s\n", n, enumerated(n), sensorsFound(),
+               (unsigned long long)(sim.cycles - start), (sim.cycles - start) * SIM_NS_PER_CYCLE / 1e6,
+               enumerated(n) == expect && sensorsFound() == expect ? "" : "  FAIL");
+        if(enumerated(n) != expect || sensorsFound() != expect) fail = 1;
+    }
+    return fail;
+
+}
+
+static void energy(void){
+
+    uint64_t awake  = sim.cycles - sim.sleep_cycles;
+    uint64_t busy   = awake - sim.nop_cycles;
+    double   ua     = sim.cycles ? ((double)awake * SIM_IDD_ACTIVE_UA + (double)sim.sleep_cycles * SIM_IPD_WDT_UA) / sim.cycles : 0.0;
+
+    printf("busy %.2f%%  idle %.2f%%  asleep %.2f%% in %u sleeps  watchdog resets %u\n",
+           100.0 * busy / sim.cycles, 100.0 * sim.nop_cycles / sim.cycles, 100.0 * sim.sleep_cycles / sim.cycles,
+           sim.sleeps, sim.wdt_resets);
+    printf("supply ~%.0f uA average, ~%u uA always awake (%u uA awake, %u uA asleep)\n",
+           ua, SIM_IDD_ACTIVE_UA, SIM_IDD_ACTIVE_UA, SIM_IPD_WDT_UA);
+
+}
+
+/* THERMAL TRANSIENT
+ * Steady at 30.3C, a 4s ramp to 50C from 30s and back to 30.3C from 60s.
+ * Reaction is the time from the true temperature reaching 50C, or dropping
+ * below 31C, until the PWM period that first starts with the duty of 50C,
+ * or 30C. The steady error is
+ * the reading against the true temperature in the last 20s of each steady
+ * part. */
+#define STEP_UP         SIM_MS(34000)                                           /* reaches 50C */
+#define STEP_DOWN       SIM_MS(63858)                                           /* 60s + 4s * 19 / 19.7, below 31C */
+#define TRANSIENT_END   SIM_MS(90000)
+
+static uint64_t riseAt, fallAt;
+static uint64_t prevSampleAt;
+static int16_t  prevSample;
+static int64_t  errSum;
+static uint32_t errCount;
+static uint32_t levelSamples[4];
+
+static int steadyWindow(uint64_t t){
+
+    return (t >= SIM_MS(10000) && t < STEP_UP) || (t >= SIM_MS(70000) && t < TRANSIENT_END);
+
+}
+
+static void onTransient(struct ds18b20_sim *dev, uint64_t now){
+
+    int16_t reading = (int16_t)((tempMSB << 8) | tempLSB);                      /* read from the previous conversion */
+
+    if(prevSampleAt && steadyWindow(prevSampleAt)){
+        errSum += reading > prevSample ? reading - prevSample : prevSample - reading;
+        errCount++;
+    }
+    prevSample      = dev->sample;
+    prevSampleAt    = now;
+    levelSamples[ds18b20_sim_resolution(dev) - 9]++;                            /* what the sensor converts at, not what was asked */
+    if(!riseAt && now >= STEP_UP && CURVE_LEVEL >= FAN_DUTY10(50)){
+        riseAt = CURVE_CHANGED_AT;
+    }
+    if(!fallAt && now >= STEP_DOWN && CURVE_LEVEL <= FAN_DUTY10(30)){
+        fallAt = CURVE_CHANGED_AT;
+    }
+
+}
+
+static void transient(void){
+
+    uint64_t awake;
+
+    parseProfile("0:30.3,30:30.3,34:50,60:50,64:30.3,90:30.3");
+    boot(1);
+    sensor[0].onConvert = onTransient;
+    sim_run(firmware_main, TRANSIENT_END);
+    awake = sim.cycles - sim.sleep_cycles;
+    printf("thermal transient, %s sampling\n", SAMPLING_ADAPTIVE ? "adaptive" : "fixed");
+    printf("  reaction  30C -> 50C %7.1f ms  50C -> 30C %7.1f ms\n",
+           riseAt ? (riseAt - STEP_UP) * SIM_NS_PER_CYCLE / 1e6 : -1.0,
+           fallAt ? (fallAt - STEP_DOWN) * SIM_NS_PER_CYCLE / 1e6 : -1.0);
+    printf("  steady error %.3f C average over %u samples\n", errCount ? errSum / 16.0 / errCount : 0.0, errCount);
+    printf("  samples at 9/10/11/12 bits %u/%u/%u/%u  conversions %u  bus resets %u  eeprom writes %u\n",
+           levelSamples[0], levelSamples[1], levelSamples[2], levelSamples[3],
+           sensor[0].conversions, sensor[0].resets, sensor[0].eepromWrites);
+    printf("  cpu busy %llu modelled cycles  interrupt %llu  awake %.2f%%  supply ~%.0f uA\n",
+           (unsigned long long)(awake - sim.nop_cycles), (unsigned long long)sim.isr_cycles,
+           100.0 * awake / sim.cycles,
+           ((double)awake * SIM_IDD_ACTIVE_UA + (double)sim.sleep_cycles * SIM_IPD_WDT_UA) / sim.cycles);
+
+}
+
+/* REPLAY
+ * The reference is the old pipeline, whole degrees of each reading straight
+ * into the curve. A reference change that holds for 2s is a real move, the
+ * rest is the hunting the filter is there to remove. Added latency is from
+ * the reading that made a move to the first PWM period with the new duty,
+ * or past it in the same direction. */
+#define MOVE_HOLD       SIM_MS(2000)
+
+struct move {
+    uint64_t at;
+    unsigned duty;
+};
+
+static struct move refMove[MAX_MOVES], fanMove[MAX_MOVES];
+static int refMoves, fanMoves;
+static struct move pending;
+static unsigned refDuty;
+static uint32_t refChanges, readings;
+static uint32_t baseChanges, baseWrites;
+static int started;
+
+static void addMove(struct move *list, int *n, uint64_t at, unsigned duty){
+
+    if(*n < MAX_MOVES){
+        list[*n].at     = at;
+        list[*n].duty   = duty;
+        (*n)++;
+    }
+
+}
+
+static void onReplayRead(struct ds18b20_sim *dev, uint64_t now){
+
+    int16_t  raw  = (int16_t)(dev->scratchpad[0] | (dev->scratchpad[1] << 8));
+    unsigned duty = FAN_DUTY10(raw >> 4);
+
+    if(!started){                                                               /* the boot duty is not a change */
+        started     = 1;
+        baseChanges = CURVE_CHANGES;
+        baseWrites  = sim.sfr_writes[SFR_CCPR1L];
+        refDuty     = CURVE_LEVEL;
+        pending.at  = 0;
+    }
+    if(CURVE_CHANGES != baseChanges + (uint32_t)fanMoves){                     /* one compare per loop, one change at most */
+        addMove(fanMove, &fanMoves, CURVE_CHANGED_AT, CURVE_LEVEL);
+    }
+    readings++;
+    if(duty != refDuty){
+        refChanges++;
+        if(pending.at && now - pending.at >= MOVE_HOLD){
+            addMove(refMove, &refMoves, pending.at, pending.duty);
+        }
+        pending.at      = now;
+        pending.duty    = duty;
+        refDuty         = duty;
+    }
+
+}
+
+static void replay(void){
+
+    uint64_t end = profile.at[profile.n - 1] + SIM_MS(5000);
+    uint64_t lag, lagSum = 0, lagMax = 0;
+    unsigned before;
+    int followed = 0;
+    int j;
+
+    boot(1);
+    sensor[0].onRead = onReplayRead;
+    sim_run(firmware_main, end);
+    if(pending.at && end - pending.at >= MOVE_HOLD){
+        addMove(refMove, &refMoves, pending.at, pending.duty);
+    }
+    for(int i=0;i<refMoves;i++){
+        before = i ? refMove[i-1].duty : 0;
+        for(j=0;j<fanMoves;j++){                                                /* first fan duty at or past the move */
+            if(i + 1 < refMoves && fanMove[j].at >= refMove[i+1].at){
+                j = fanMoves;                                                   /* not before the next move, held by the hysteresis */
+                break;
+            }
+            int up = refMove[i].duty > before;
+            if(fanMove[j].at < refMove[i].at && !(j + 1 < fanMoves && fanMove[j+1].at < refMove[i].at) &&
+               (up ? fanMove[j].duty >= refMove[i].duty : fanMove[j].duty <= refMove[i].duty)){
+                break;                                                          /* already there before the reading */
+            }
+            if(fanMove[j].at >= refMove[i].at &&
+               (up ? fanMove[j].duty >= refMove[i].duty : fanMove[j].duty <= refMove[i].duty)){
+                break;
+            }
+        }
+        if(j == fanMoves) continue;
+        lag = fanMove[j].at > refMove[i].at ? fanMove[j].at - refMove[i].at : 0;
+        lagSum += lag;
+        if(lag > lagMax) lagMax = lag;
+        followed++;
+    }
+    printf("replay %.1f s, %u readings, ema 1/%d, hysteresis %.2fC\n", end / 2000000.0, readings,
+           1 << TEMP_EMA_SHIFT, FAN_HYSTERESIS / 16.0);
+    printf("  duty changes %u (unfiltered %u)  CCPR1L writes %u\n", CURVE_CHANGES - baseChanges, refChanges,
+           sim.sfr_writes[SFR_CCPR1L] - baseWrites);
+    printf("  moves followed %d/%d  added latency avg %.1f ms max %.1f ms\n", followed, refMoves,
+           followed ? lagSum / followed * SIM_NS_PER_CYCLE / 1e6 : 0.0, lagMax * SIM_NS_PER_CYCLE / 1e6);
+
+}
+
+/* FAN SPEED CONTROL
+ * 30.3C until 20s, then 45C. The fan makes FAN_BENCH_RPM at 100%, less
+ * than the FAN_RPM_MAX the curve is scaled to, so the open loop runs it
+ * slow at every duty. Settling is from the step until the speed stays within
+ * 5% of the curve speed for 45C, overshoot is past it as a part of the step.
+ * The rotor is locked from 50s to 55s, the firmware has to go to 100% and
+ * blink the LED, then get back to the curve speed. */
+#define FAN_BENCH_RPM   2600
+#define FAN_STEP        SIM_MS(20000)
+#define FAN_STALL       SIM_MS(50000)
+#define FAN_RELEASE     SIM_MS(55000)
+#define FAN_END         SIM_MS(65000)
+
+static double   fanFrom, fanPeak, fanErrSum;
+static uint32_t fanErrCount;
+static uint64_t fanOutside, fanFull, fanBack, fanBlinkAt;
+static unsigned fanBlinks;
+static int      fanLed = -1;
+
+static int fanNear(double rpm){
+
+    return rpm > FAN_RPM(45) * 0.95 && rpm < FAN_RPM(45) * 1.05;
+
+}
+
+static void onFan(uint64_t now){
+
+    int led = (sim.latch >> SIM_BIT_GP5) & 0x1;
+
+    fan.stalled = now >= FAN_STALL && now < FAN_RELEASE;
+    if(now < FAN_STEP){
+        fanFrom = fan.rpm;
+    } else if(now < FAN_STALL){
+        if(fan.rpm > fanPeak) fanPeak = fan.rpm;
+        if(!fanNear(fan.rpm)) fanOutside = now;
+        if(now >= FAN_STALL - SIM_MS(10000)){
+            fanErrSum += fan.rpm > FAN_RPM(45) ? fan.rpm - FAN_RPM(45) : FAN_RPM(45) - fan.rpm;
+            fanErrCount++;
+        }
+    } else if(now < FAN_RELEASE){
+        if(!fanFull && sim_pwm_output_permille() == 1000) fanFull = now;
+        if(fanLed >= 0 && led != fanLed){
+            fanBlinks++;
+            if(!fanBlinkAt) fanBlinkAt = now;
+        }
+    } else if(!fanBack && fanNear(fan.rpm)){
+        fanBack = now;
+    }
+    fanLed = led;
+
+}
+
+static void fanControlBench(void){
+
+    parseProfile("0:30.3,20:30.3,20.001:45,65:45");
+    boot(1);
+    fan.rpmMax = FAN_BENCH_RPM;
+    fanWatch = onFan;
+    sim_run(firmware_main, FAN_END);
+    printf("fan control, %s, fan %u rpm at 100%% against %u expected, tau %u ms\n",
+           FAN_TACH ? "closed loop on the tach" : "open loop", FAN_BENCH_RPM, FAN_RPM_MAX, FAN_TAU_MS);
+    printf("  30C -> 45C  %.0f -> %u rpm  settling (5%%) %.0f ms  overshoot %.1f%%\n", fanFrom, FAN_RPM(45),
+           fanOutside + SIM_MS(1) < FAN_STALL ? (fanOutside - FAN_STEP) * SIM_NS_PER_CYCLE / 1e6 : -1.0,
+           fanPeak > FAN_RPM(45) ? 100.0 * (fanPeak - FAN_RPM(45)) / (FAN_RPM(45) - fanFrom) : 0.0);
+    printf("  steady error %.1f rpm (%.1f%%)  duty changes %u\n", fanErrCount ? fanErrSum / fanErrCount : 0.0,
+           fanErrCount ? 100.0 * fanErrSum / fanErrCount / FAN_RPM(45) : 0.0, sim.pwm_changes);
+    printf("  stall  100%% after %.0f ms  LED blinks %u from %.0f ms  back within 5%% %.0f ms after release\n",
+           fanFull ? (fanFull - FAN_STALL) * SIM_NS_PER_CYCLE / 1e6 : -1.0, fanBlinks,
+           fanBlinkAt ? (fanBlinkAt - FAN_STALL) * SIM_NS_PER_CYCLE / 1e6 : -1.0,
+           fanBack ? (fanBack - FAN_RELEASE) * SIM_NS_PER_CYCLE / 1e6 : -1.0);
+
+}
+
+/* CRC AND A BAD BUS
+ * First what the CRC costs in one scratchpad read. Then a steady 40C with
+ * GP4 clean, noisy, open (the PIC reads 0xFF/0xFF) and shorted in turn.
+ * Every reading the fan gets is checked against the true 40C, and so is the
+ * curve step it is set to: nothing the bus makes up may move the fan, only
+ * the fail-safe once the sensor can not be read at all. With the check
+ * built in, a wrong reading used in any part, or a clean part where the
+ * curve leaves the true step once it is there or never gets there (it
+ * starts in the fail-safe after the short), is a failure. */
+#define CRC_TEMP        40
+#define CRC_NOISE_PPM   10000                                                   /* 1% of the GPIO reads see GP4 flipped */
+
+static const struct {
+    uint64_t    until;
+    int         fault;
+    uint32_t    noise;
+    const char *name;
+} crcPhase[] = {
+    {SIM_MS(20000), SIM_BUS_OK,    0,             "clean"},
+    {SIM_MS(50000), SIM_BUS_OK,    CRC_NOISE_PPM, "noise 1%"},
+    {SIM_MS(60000), SIM_BUS_OPEN,  0,             "open"},
+    {SIM_MS(70000), SIM_BUS_SHORT, 0,             "shorted"},
+    {SIM_MS(90000), SIM_BUS_OK,    0,             "clean"},
+};
+#define CRC_PHASES      (int)(sizeof(crcPhase) / sizeof(crcPhase[0]))
+
+static struct {
+    uint32_t reads, errors, bad;
+    uint64_t failSafe;
+    unsigned levelMin, levelMax;
+    int      settled;                                                           /* at the true step in this part */
+    uint32_t moved;                                                             /* fan updates off it after that */
+} crcStat[CRC_PHASES];
+static int      crcNow;
+static uint64_t crcLast;
+static uint8_t  crcErrors;
+static int      crcReading = -1;
+
+static int crcPhaseAt(uint64_t now){
+
+    int i = 0;
+
+    while(i < CRC_PHASES - 1 && now >= crcPhase[i].until) i++;
+    return i;
+
+}
+
+static void onCrcFan(uint64_t now){
+
+    int i = crcPhaseAt(now);
+    int reading = (tempMSB << 8) | tempLSB;
+
+    if(i != crcNow){
+        crcNow = i;
+        sim_bus_fault(crcPhase[i].fault, crcPhase[i].noise);
+    }
+    crcStat[i].errors += (uint8_t)(readErrors - crcErrors);                     /* readErrors wraps at 256 */
+    crcErrors = readErrors;
+    if(sensor[0].conversions < 2){                                              /* no reading yet, the boot step */
+        crcLast = now;
+        return;
+    }
+    if(reading != crcReading){
+        if(reading != CRC_TEMP * 16) crcStat[i].bad++;                          /* a new reading, and not a true one */
+        crcReading = reading;
+    }
+    if(pwmSelect == FAN_LUT_SIZE - 1) crcStat[i].failSafe += now - crcLast;
+    crcLast = now;
+    if(CURVE_LEVEL < crcStat[i].levelMin) crcStat[i].levelMin = CURVE_LEVEL;
+    if(CURVE_LEVEL > crcStat[i].levelMax) crcStat[i].levelMax = CURVE_LEVEL;
+    if(CURVE_LEVEL == FAN_DUTY10(CRC_TEMP)) crcStat[i].settled = 1;
+    else if(crcStat[i].settled) crcStat[i].moved++;
+
+}
+
+static void onCrcRead(struct ds18b20_sim *dev, uint64_t now){
+
+    (void)dev;
+    crcStat[crcPhaseAt(now)].reads++;
+
+}
+
+static int crcBench(void){
+
+    uint64_t start, isr, code;
+    const char *variant = OW_CRC == 2 ? "nibble table" : OW_CRC ? "bitwise" : "none";
+    int clean, ok, fail = 0;
+
+    boot(1);
+    sim_run(SYSTEM_Initialize, SIM_MS(10000));
+    start   = sim.cycles;
+    isr     = sim.isr_cycles;
+    code    = sim.code_cycles;
+    sim.isr_max = 0;
+    sim_run(doRead, SIM_MS(10000));
+    printf("scratchpad CRC %s, one readTemperatures()\n", variant);
+    printf("  %llu modelled cycles %.2f ms  interrupt %llu  CRC ~%llu cycles hand counted (%.1f per byte)  longest interrupt %llu\n",
+           (unsigned long long)(sim.cycles - start), (sim.cycles - start) * SIM_NS_PER_CYCLE / 1e6,
+           (unsigned long long)(sim.isr_cycles - isr), (unsigned long long)(sim.code_cycles - code),
+           (sim.code_cycles - code) / 9.0, (unsigned long long)sim.isr_max);
+
+    parseProfile("0:40,90:40");
+    boot(1);
+    for(int i=0;i<CRC_PHASES;i++){
+        crcStat[i].levelMin = UINT32_MAX;
+    }
+    crcNow = 0;
+    sensor[0].onRead    = onCrcRead;
+    fanWatch = onCrcFan;
+    sim_run(firmware_main, crcPhase[CRC_PHASES - 1].until);
+    printf("steady %dC on a bad bus, curve step %u, GP4 reads flipped %u\n", CRC_TEMP, (unsigned)FAN_DUTY10(CRC_TEMP), sim.bus_flips);
+    for(int i=0;i<CRC_PHASES;i++){
+        clean = crcPhase[i].fault == SIM_BUS_OK && !crcPhase[i].noise;
+        ok    = !crcStat[i].bad && (!clean || (crcStat[i].settled && !crcStat[i].moved));
+        printf("  %6.0fs %-9s scratchpad reads %4u  failed checks %4u  wrong readings used %3u  fail-safe %5.0f ms  curve step %u..%u%s\n",
+               crcPhase[i].until / 2000000.0, crcPhase[i].name, crcStat[i].reads, crcStat[i].errors, crcStat[i].bad,
+               crcStat[i].failSafe * SIM_NS_PER_CYCLE / 1e6, crcStat[i].levelMin, crcStat[i].levelMax,
+               OW_CRC && !ok ? "  FAIL" : "");
+        if(OW_CRC && !ok) fail = 1;
+    }
+    return fail;
+
+}
+
+/* SENSOR LOST
+ * Every fault is injected at LOST_RUNS points of the sample period, from
+ * boot with a steady temperature: the bus shorted, the sensor gone (no
+ * presence pulse), the sensor pulled off 12 bits into a scratchpad read,
+ * and Timer1 stopped under the 1-wire engine in the middle of a queue.
+ * The sensor missing from power up is timed from boot, the same each run.
+ * For the first three the time until GP2 runs at the fail-safe duty has to
+ * stay under the bound, the slowest sample and the next fast one with the
+ * failed reads. At 40C the PWM runs and main() waits on Timer1, at 25C the
+ * fan is off and the PIC sleeps on the watchdog, which takes longer.
+ * For the stall the watchdog has to reset within its awake period, 72ms,
+ * asleep the engine does not run anyway. */
+#define LOST_RUNS       8
+#define LOST_AT         SIM_MS(20000)                                           /* settled at the slowest sample rate */
+#define LOST_STEP       SIM_MS(450)
+#define LOST_WDT_BOUND  SIM_MS(72)
+#if SAMPLING_ADAPTIVE
+#define LOST_BOUND_PWM  SIM_MS(2400)                                            /* 1152ms + 768ms at 12 bits, 144ms + 96ms at 9 */
+#define LOST_BOUND_OFF  SIM_MS(4200)                                            /* on the watchdog, 1152ms + 2304ms, 144ms + 288ms */
+#else
+#define LOST_BOUND_PWM  SIM_MS(5000)                                            /* 2304ms + 96ms, twice */
+#define LOST_BOUND_OFF  SIM_MS(5500)                                            /* on the watchdog, 2304ms + 288ms, twice */
+#endif
+
+enum { LOST_SHORT, LOST_GONE, LOST_MID_BYTE, LOST_AT_BOOT, LOST_STALL, LOST_FAULTS };
+
+static const char *lostName[LOST_FAULTS] = {"bus shorted", "no presence", "lost mid-byte", "none at boot", "engine stall"};
+static int      lostFault;
+static uint64_t lostAt, lostDone;
+static int      lostInjected;
+
+static void onLost(uint64_t now){
+
+    if(!lostInjected){
+        if(now < lostAt || (lostFault == LOST_STALL && !owQueuePos)) return;
+        lostInjected = 1;
+        lostAt = now;
+        switch(lostFault){
+            case LOST_SHORT:    sim_bus_fault(SIM_BUS_SHORT, 0); break;
+            case LOST_GONE:     sensor[0].gone = 1; break;
+            case LOST_MID_BYTE: sensor[0].dropAfter = 12; break;               /* in the temperature MSB */
+            case LOST_AT_BOOT:  break;                                          /* gone before boot() */
+            default:            sim.sfr[SFR_T1CON] &= (uint8_t)~0x01; break;   /* TMR1ON, owStart() would set it again */
+        }
+    }
+    if(lostDone) return;
+    if(lostFault == LOST_STALL ? sim.wdt_resets > 0 : sim_pwm_output_permille() >= FAN_CURVE_D3 * 10u){
+        lostDone = lostFault == LOST_STALL ? sim.wdt_reset_at : now;           /* the reset itself, not the plant call after it */
+    }
+
+}
+
+static int sensorLostBench(void){
+
+    static const int temps[2] = {40, 25};
+    char script[64];
+    uint64_t bound, took, worst, best;
+    int fail = 0;
+
+    printf("sensor lost, time to the fail-safe duty (%d%%) or the watchdog reset, %d runs each\n",
+           FAN_CURVE_D3, LOST_RUNS);
+    for(int t=0;t<2;t++){
+        for(int f=0;f<LOST_FAULTS;f++){
+            if(f == LOST_STALL && temps[t] < FAN_CURVE_T0) continue;           /* asleep, nothing to stall */
+            bound   = f == LOST_STALL ? LOST_WDT_BOUND : temps[t] < FAN_CURVE_T0 ? LOST_BOUND_OFF : LOST_BOUND_PWM;
+            worst   = 0;
+            best    = UINT64_MAX;
+            for(int i=0;i<LOST_RUNS;i++){
+                snprintf(script, sizeof(script), "0:%d,60:%d", temps[t], temps[t]);
+                parseProfile(script);
+                boot(1);
+                lostFault       = f;
+                lostAt          = f == LOST_AT_BOOT ? 0 : LOST_AT + (uint64_t)i * LOST_STEP;
+                sensor[0].gone  = f == LOST_AT_BOOT;
+                lostDone        = 0;
+                lostInjected    = 0;
+                fanWatch        = onLost;
+                sim_run(firmware_main, lostAt + bound + SIM_MS(2000));
+                took = lostDone ? lostDone - lostAt : UINT64_MAX;
+                if(took > worst) worst = took;
+                if(took < best) best = took;
+            }
+            printf("  %2dC %-14s %8.1f .. %8.1f ms  bound %6.0f ms  %s\n", temps[t], lostName[f],
+                   best == UINT64_MAX ? -1.0 : best * SIM_NS_PER_CYCLE / 1e6,
+                   worst == UINT64_MAX ? -1.0 : worst * SIM_NS_PER_CYCLE / 1e6,
+                   bound * SIM_NS_PER_CYCLE / 1e6, worst <= bound ? "ok" : "TOO LATE");
+            if(worst > bound) fail = 1;
+        }
+    }
+    fanWatch = NULL;
+    return fail;
+
+}
+
+/* PROFILE
+ * Enter to exit, the waits and the interrupts on the way included, the
+ * cycles of those interrupts also on their own. Only the time the simulator
+ * models is in it: the register accesses, the delays and the HAL_CYCLES()
+ * hand counts, not the instructions XC8 makes of the C in between. It shows
+ * where a change moves the time against the last run, it is no measure of
+ * a function on the pic. The slot times are what the DS18B20 sees, those
+ * are checked. */
+#define PROFILE_SENSORS     (DS18B20_MAX_SENSORS > 1 ? 2 : 1)
+#define PROFILE_SCRIPT      "0:28,20:50,40:35,60:40"
+#define PROFILE_SECONDS     60
+
+static int profileBench(void){
+
+    const struct sim_slot_spec *spec;
+    const struct sim_slot_stat *st;
+    struct profile_function *fn;
+    int fail = 0;
+
+    parseProfile(PROFILE_SCRIPT);
+    boot(PROFILE_SENSORS);
+    profile_sim_clear();
+    sim_run(firmware_main, SIM_MS(PROFILE_SECONDS * 1000));
+    printf("modelled cycle profile, %d sensors, %d s of %s\n", PROFILE_SENSORS, PROFILE_SECONDS, PROFILE_SCRIPT);
+    if(!sim_profile.n){
+        printf("  nothing marked, build with -DPROFILE=1\n");
+    } else {
+        printf("  %-20s %6s %9s %9s %9s %9s  calls under 2^k cycles\n", "function", "calls", "min", "avg", "max", "isr avg");
+    }
+    for(int i=0;i<sim_profile.n;i++){
+        fn = &sim_profile.fn[i];
+        if(!fn->calls) continue;
+        printf("  %-20s %6u %9llu %9llu %9llu %9llu ", fn->name, fn->calls, (unsigned long long)fn->min,
+               (unsigned long long)(fn->cycles / fn->calls), (unsigned long long)fn->max,
+               (unsigned long long)(fn->isr / fn->calls));
+        for(int k=0;k<PROFILE_BUCKETS;k++){
+            if(fn->bucket[k]) printf(" %u<2^%d", fn->bucket[k], k);
+        }
+        printf("\n");
+    }
+    printf("1-wire slots against the DS18B20 windows\n");
+    printf("  %-16s %6s %8s %8s %13s %7s %8s\n", "", "count", "min us", "max us", "window us", "outside", "worst us");
+    for(int i=0;i<SIM_SLOT_KINDS;i++){
+        char window[16];
+
+        spec = &sim_slot_spec[i];
+        st   = &sim.slot[i];
+        if(spec->max_us) snprintf(window, sizeof(window), "%u-%u", spec->min_us, spec->max_us);
+        else             snprintf(window, sizeof(window), "%u-", spec->min_us);
+        printf("  %-16s %6u %8.1f %8.1f %13s %7u %8.1f\n", spec->name, st->count,
+               st->count ? st->min * SIM_NS_PER_CYCLE / 1000.0 : 0.0, st->max * SIM_NS_PER_CYCLE / 1000.0,
+               window, st->out, st->worst * SIM_NS_PER_CYCLE / 1000.0);
+        if(st->out) fail = 1;
+    }
+    if(sim_profile.dropped) printf("  %u frames left open by a reset or the end of the run\n", sim_profile.dropped);
+    return fail;
+
+}
+
+static void doResolution(void)  { resolutionCheck(0x7F); }
+static void doCompare(void)     { tempMSB = 0x02; tempLSB = 0x30; temperatureCompare(); }
+
+int main(int argc, char **argv){
+
+    double seconds = 30.0;
+    int    secondsSet = 0;
+    int    fleetBoards = 0;
+    int    fleetWorkers = 0;
+    int    npolicies = 0;
+    struct fleet_policy policies[FLEET_MAX_POLICIES];
+
+    for(int i=1;i<argc;i++){
+        if(!strcmp(argv[i], "-s") && i + 1 < argc){
+            seconds = atof(argv[++i]);
+            secondsSet = 1;
+        } else if(!strcmp(argv[i], "-p") && i + 1 < argc){
+            if(parseProfile(argv[++i])){
+                fprintf(stderr, "bad profile: %s\n", argv[i]);
+                return 1;
+            }
+        } else if(!strcmp(argv[i], "-n") && i + 1 < argc){
+            sensors = atoi(argv[++i]);
+            if(sensors < 1 || sensors > SIM_SENSORS){
+                fprintf(stderr, "sensors 1 to %d, build with -DDS18B20_MAX_SENSORS for more\n", SIM_SENSORS);
+                return 1;
+            }
+        } else if(!strcmp(argv[i], "-u") && i + 1 < argc){
+            if(!TELEMETRY){
+                fprintf(stderr, "no telemetry on GP0, built with -DTELEMETRY=0\n");
+                return 1;
+            }
+            telemetryOut = fopen(argv[++i], "wb");
+            if(!telemetryOut){
+                perror(argv[i]);
+                return 1;
+            }
+        } else if(!strcmp(argv[i], "-b")){
+            return busSweep();
+        } else if(!strcmp(argv[i], "-t")){
+            transient();
+            return 0;
+        } else if(!strcmp(argv[i], "-r") && i + 1 < argc){
+            if(!strcmp(argv[++i], "hunt")){
+                huntTrace();
+            } else if(loadTrace(argv[i])){
+                fprintf(stderr, "bad trace: %s\n", argv[i]);
+                return 1;
+            }
+            replay();
+            return 0;
+        } else if(!strcmp(argv[i], "-f")){
+            fanControlBench();
+            return 0;
+        } else if(!strcmp(argv[i], "-c")){
+            return crcBench();
+        } else if(!strcmp(argv[i], "-w")){
+            return sensorLostBench();
+        } else if(!strcmp(argv[i], "-q")){
+            quiet = 1;
+        } else if(!strcmp(argv[i], "-m")){
+            return profileBench();
+        } else if(!strcmp(argv[i], "-F") && i + 1 < argc){
+            fleetBoards = atoi(argv[++i]);
+        } else if(!strcmp(argv[i], "-j") && i + 1 < argc){
+            fleetWorkers = atoi(argv[++i]);
+        } else if(!strcmp(argv[i], "-P") && i + 1 < argc){
+            if(npolicies == FLEET_MAX_POLICIES || fleet_policy_parse(&policies[npolicies], argv[++i])){
+                fprintf(stderr, "bad policy: %s, name=t0:d0,t1:d1,t2:d2,t3:d3 with t0 > %d, t3 <= %d, up to %d\n",
+                        argv[i], FAN_LUT_BASE, FAN_LUT_BASE + FAN_LUT_SIZE - 1, FLEET_MAX_POLICIES);
+                return 1;
+            }
+            npolicies++;
+        } else {
+            fprintf(stderr, "usage: %s [-s seconds] [-p time:celsius,...] [-n sensors] [-u file] [-b] [-t] [-r trace] [-f] [-c] [-w] [-q]\n"
+                            "       [-m] [-F boards [-j workers] [-P name=t0:d0,t1:d1,t2:d2,t3:d3]...]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if(fleetBoards){
+        if(!npolicies) npolicies = fleet_policy_defaults(policies);
+        return fleet_run(policies, npolicies, fleetBoards, secondsSet ? seconds : FLEET_SECONDS, fleetWorkers);
+    }
+
+    printf("routines, modelled cycles: register accesses, delays and hand counts (%d ns per cycle)\n", SIM_NS_PER_CYCLE);
+    boot(sensors);
+    measure("SYSTEM_Initialize()", SYSTEM_Initialize);
+    printf("  sensors %d  enumerated %d/%d\n", sensors, enumerated(sensors), sensorsFound());
+    measure("CONVERT T", doConversion);
+    measure("readTemperatures()", doRead);
+    measure("resolutionCheck(0x7F)", doResolution);
+    measure("temperatureCompare()", doCompare);
+
+    printf("main() for %.1f s\n", seconds);
+    boot(sensors);
+    sensor[0].onConvert = onConvert;
+    sim_run(firmware_main, (uint64_t)(seconds * 2000000.0));
+    if(loops){
+        printf("loops %llu  period min %llu max %llu cycles  work avg %llu cycles (%.2f ms)\n",
+               (unsigned long long)loops, (unsigned long long)loopMin, (unsigned long long)loopMax,
+               (unsigned long long)(loopWork / loops), loopWork / loops * SIM_NS_PER_CYCLE / 1e6);
+    }
+    printf("interrupts %u  cycles in interrupt %llu  free while the bus was busy %llu\n", sim.isr_count,
+           (unsigned long long)sim.isr_cycles, (unsigned long long)sim.nop_cycles);
+    printf("cycles %llu  in delays %llu  in __delay_ms %llu\n", (unsigned long long)sim.cycles,
+           (unsigned long long)sim.delay_cycles, (unsigned long long)sim.idle_cycles);
+    energy();
+    printf("PWM average duty %u.%u%%  sensor conversions %u resets %u eeprom writes %u bad slots %u  read errors %u\n",
+           sim_pwm_average_permille() / 10, sim_pwm_average_permille() % 10,
+           sensor[0].conversions, sensor[0].resets, sensor[0].eepromWrites, sensor[0].badSlots, readErrors);
+#if TELEMETRY
+    uart_sim_flush(&uart, sim.cycles);
+    printf("telemetry frames %u  bytes %u framing errors %u  Timer0 interrupts %u",
+           telemetryFrames, uart.bytes, uart.framingErrors, sim.t0_isr_count);
+    if(telemetryFrames){
+        printf(", %.1f and %.0f modelled cycles per frame, longest interrupt %llu",
+               (double)sim.t0_isr_count / telemetryFrames, (double)sim.t0_isr_cycles / telemetryFrames,
+               (unsigned long long)sim.isr_max);
+    }
+    printf("\n");
+#endif
+    if(telemetryOut) fclose(telemetryOut);
+    if(sim.wdt_resets){
+        printf("FAIL  the watchdog reset the pic %u times with nothing wrong on the bus\n", sim.wdt_resets);
+        return 1;
+    }
+    return 0;
+
+}
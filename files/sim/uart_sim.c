@@ -0,0 +1,76 @@
+/*
+ * File:   uart_sim.c
+ * Author: George Nikolaidis
+ *
+ * Serial receiver stand-in, see uart_sim.h
+ * The line is constant between two edges, so the samples that fall in
+ * between are all taken at the next edge with the level it ends.
+ */
+
+#include "pic12f615_sim.h"
+#include "uart_sim.h"
+
+void uart_sim_init(struct uart_sim *uart, int pin, unsigned baud, uart_sim_byte_fn onByte, void *ctx){
+
+    uart->pin           = pin;
+    uart->bitCycles     = 1e9 / SIM_NS_PER_CYCLE / baud;
+    uart->onByte        = onByte;
+    uart->ctx           = ctx;
+    uart->level         = 1;
+    uart->busy          = 0;
+    uart->startAt       = 0;
+    uart->bit           = 0;
+    uart->shift         = 0;
+    uart->bytes         = 0;
+    uart->framingErrors = 0;
+
+}
+
+static void sampleUntil(struct uart_sim *uart, uint64_t cycles){
+
+    uint64_t at;
+
+    while(uart->busy){
+        at = uart->startAt + (uint64_t)((uart->bit + 0.5) * uart->bitCycles);  /* middle of the bit */
+        if(at >= cycles) break;
+        if(uart->bit == 0){
+            if(uart->level){
+                uart->busy = 0;                                                 /* a glitch, not a start bit */
+            }
+        } else if(uart->bit <= 8){
+            uart->shift = (uint8_t)((uart->shift >> 1) | (uart->level ? 0x80 : 0));
+        } else {
+            uart->busy = 0;
+            if(uart->level){
+                uart->bytes++;
+                if(uart->onByte) uart->onByte(uart->ctx, uart->shift, at);
+            } else {
+                uart->framingErrors++;                                          /* wait for the line to go high again */
+            }
+        }
+        uart->bit++;
+    }
+
+}
+
+void uart_sim_watch(void *ctx, uint8_t pins, uint64_t cycles){
+
+    struct uart_sim *uart = ctx;
+    int level = (pins >> uart->pin) & 0x1;
+
+    if(level == uart->level) return;
+    sampleUntil(uart, cycles);
+    uart->level = level;
+    if(!uart->busy && !level){
+        uart->busy      = 1;                                                    /* falling edge of a start bit */
+        uart->startAt   = cycles;
+        uart->bit       = 0;
+    }
+
+}
+
+void uart_sim_flush(struct uart_sim *uart, uint64_t cycles){
+
+    sampleUntil(uart, cycles);
+
+}
@@ -0,0 +1,42 @@
+/*
+ * File:   uart_sim.h
+ * Author: George Nikolaidis
+ *
+ * Serial receiver stand-in for the PIC12F615 simulator, 8N1, LSB first, a
+ * watch on one output pin, see sim_watch() in pic12f615_sim.h.
+ * It samples in the middle of each bit counted from the falling edge of the
+ * start bit, as a UART does, so edges that come late by a part of a bit
+ * still read right. A 0 where the stop bit should be is a framing error,
+ * the byte is dropped and the receiver waits for the line to go high.
+ * A byte is complete at the middle of its stop bit, which is only seen at
+ * the next edge or at uart_sim_flush().
+ */
+
+#ifndef UART_SIM_H
+#define UART_SIM_H
+
+#include <stdint.h>
+
+typedef void (*uart_sim_byte_fn)(void *ctx, uint8_t byte, uint64_t cycles);
+
+struct uart_sim {
+    int      pin;
+    double   bitCycles;                                                         /* instruction cycles per bit at the baud rate */
+    uart_sim_byte_fn onByte;
+    void    *ctx;
+
+    int      level;                                                             /* line level since lastEdge, idles high */
+    int      busy;                                                              /* inside a byte */
+    uint64_t startAt;                                                           /* falling edge of the start bit */
+    int      bit;                                                               /* next bit to sample, 0 start .. 9 stop */
+    uint8_t  shift;
+
+    uint32_t bytes;
+    uint32_t framingErrors;
+};
+
+void uart_sim_init(struct uart_sim *uart, int pin, unsigned baud, uart_sim_byte_fn onByte, void *ctx);
+void uart_sim_watch(void *ctx, uint8_t pins, uint64_t cycles);                 /* a sim_watch_fn */
+void uart_sim_flush(struct uart_sim *uart, uint64_t cycles);
+
+#endif
@@ -0,0 +1,54 @@
+/*
+ * File:   telemetry.h
+ * Author: George Nikolaidis
+ *
+ * Telemetry frame sent on GP0, 9600 8N1, one frame per sample. Shared by
+ * nmain.c, the simulator and the host decoder in files/host.
+ *
+ *   byte 0   TELEMETRY_SYNC
+ *   byte 1   sequence number, wraps, a frame dropped in the pic is a gap
+ *   byte 2,3 hottest reading LSB, MSB, signed 1/16 C as the scratchpad has it
+ *   byte 4,5 duty, 10 bit CCPR1L:DC1B, bits 9-8 in byte 5 bits 1-0
+ *            byte 5 bits 3-2 sample level (9..12 bits), bits 7-4 the flags
+ *   byte 6,7 tach period LSB, MSB in 2us, 2 per turn, 0 stopped or no tach
+ *   byte 8   scratchpad reads that failed the check, wraps
+ *   byte 9   curve step, degrees above FAN_LUT_BASE
+ *   byte 10  checksum, all 11 bytes add up to 0 mod 256
+ *
+ * A sum and not a CRC: the frame is built a byte at a time in the Timer0
+ * interrupt on a pic with no cycles to spare, the sync byte, the length and
+ * the sum are enough to find the frames again in a stream that starts half
+ * way.
+ */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#ifndef TELEMETRY
+#define TELEMETRY               1                                               /* 1 byte of RAM, see the README. 0: GP0 stays
+                                                                                 * low, no Timer0 interrupt */
+#endif
+
+#define TELEMETRY_BAUD          9600
+#define TELEMETRY_BIT_CYCLES    208                                             /* 2MHz / 9600, 0.2% fast */
+#define TELEMETRY_SYNC          0xA5
+#define TELEMETRY_FRAME         11                                              /* bytes */
+
+#define TELEMETRY_SEQ           1                                               /* byte offsets in the frame */
+#define TELEMETRY_TEMP          2
+#define TELEMETRY_DUTY          4
+#define TELEMETRY_TACH          6
+#define TELEMETRY_ERRORS        8
+#define TELEMETRY_STEP          9
+#define TELEMETRY_SUM           10
+
+#define TELEMETRY_DUTY_HIGH     0x03                                            /* byte 5 */
+#define TELEMETRY_LEVEL_SHIFT   2
+#define TELEMETRY_LEVEL         0x0C
+#define TELEMETRY_LOST          0x10                                            /* fail-safe, no sensor to go by */
+#define TELEMETRY_STALL         0x20                                            /* tach stall, 100% */
+#define TELEMETRY_HAS_TACH      0x40                                            /* built with FAN_TACH */
+
+#define TELEMETRY_TACH_RPM      15000000UL                                      /* rpm = TELEMETRY_TACH_RPM / period */
+
+#endif